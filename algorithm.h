@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <numeric>
+#include <vector>
+#include "unique_ptr_v2.h"
+
+// Algorithms over ranges of poly_v2::unique_ptr that relocate each object
+// directly into its final slot, instead of going through the move
+// constructor, move assignment and destructor of a temporary per swap.
+//
+// They live in poly rather than poly_v2 so that argument dependent lookup on
+// iterators of poly_v2::unique_ptr ranges never makes an unqualified
+// sort(...) ambiguous with std::sort; call them qualified.
+namespace poly
+{
+    // Above this storage size, sort the indices and relocate every object once.
+    constexpr size_t permute_threshold = 64;
+
+    // Reorders [first, first + order.size()) so that position i receives the
+    // element previously at order[i]. Each element is relocated once, plus one
+    // extra relocation per cycle.
+    template<typename RandomIt>
+    void apply_permutation(RandomIt first, const std::vector<size_t>& order)
+    {
+        using ptr_type = typename std::iterator_traits<RandomIt>::value_type;
+
+        std::vector<bool> done(order.size());
+        poly::relocation_batch batch(order.size() * sizeof(ptr_type));
+        ptr_type tmp;
+        for (size_t start = 0; start < order.size(); ++start)
+        {
+            if (done[start] || order[start] == start)
+                continue;
+
+            poly_v2::relocation::move(first[start], tmp);
+            size_t i = start;
+            while (true)
+            {
+                done[i] = true;
+                size_t next = order[i];
+                if (next == start)
+                {
+                    poly_v2::relocation::move(tmp, first[i]);
+                    break;
+                }
+                poly_v2::relocation::move(first[next], first[i]);
+                i = next;
+            }
+        }
+    }
+
+    // Sorts unique_ptrs with comp(const ptr&, const ptr&).
+    template<typename RandomIt, typename Compare>
+    void sort(RandomIt first, RandomIt last, Compare comp)
+    {
+        using ptr_type = typename std::iterator_traits<RandomIt>::value_type;
+
+        if constexpr (sizeof(ptr_type) <= permute_threshold)
+        {
+            // Small enough that moving through the relocating move operations is cheapest.
+            std::sort(first, last, comp);
+        }
+        else
+        {
+            std::vector<size_t> order(last - first);
+            std::iota(order.begin(), order.end(), size_t(0));
+            std::sort(order.begin(), order.end(),
+                [&](size_t a, size_t b) { return comp(first[a], first[b]); });
+            apply_permutation(first, order);
+        }
+    }
+
+    // Stable partition by pred(const ptr&). Returns the first element for
+    // which pred is false.
+    template<typename RandomIt, typename Predicate>
+    RandomIt stable_partition(RandomIt first, RandomIt last, Predicate pred)
+    {
+        std::vector<size_t> order(last - first);
+        std::iota(order.begin(), order.end(), size_t(0));
+        auto mid = std::stable_partition(order.begin(), order.end(),
+            [&](size_t i) { return pred(first[i]); });
+        auto split = mid - order.begin();
+
+        apply_permutation(first, order);
+        return first + split;
+    }
+
+    // Destroys the elements for which pred(const ptr&) is true and compacts the
+    // rest by relocating each survivor once. Returns the number removed.
+    template<typename Container, typename Predicate>
+    size_t erase_if(Container& c, Predicate pred)
+    {
+        auto first = c.begin();
+        auto out = first;
+        poly::relocation_batch batch(c.size() * sizeof(*first));
+        for (auto it = first; it != c.end(); ++it)
+        {
+            if (pred(*it))
+                it->reset();
+            else
+            {
+                if (out != it)
+                    poly_v2::relocation::move(*it, *out);
+                ++out;
+            }
+        }
+
+        auto removed = size_t(c.end() - out);
+        c.erase(out, c.end());
+        return removed;
+    }
+
+    // Progress of an incremental compact(). Reset it when the range changes
+    // between slices.
+    struct compact_cursor
+    {
+        size_t read = 0;    // next element to visit
+        size_t write = 0;   // next free position
+    };
+
+    // Visits up to budget elements of [first, last) from cursor, moving spilled
+    // objects back inline where they fit and relocating live elements over
+    // the empty ones in front of them, keeping their order. Between slices
+    // [write, read) is empty. Returns true once the whole range has been
+    // visited, at which point [first + cursor.write, last) is empty.
+    template<typename RandomIt>
+    bool compact(RandomIt first, RandomIt last, size_t budget, compact_cursor& cursor)
+    {
+        size_t n = size_t(last - first);
+        poly::relocation_batch batch(cursor.read < n ? std::min(budget, n - cursor.read) * sizeof(*first) : 0);
+        for (; budget && cursor.read < n; --budget, ++cursor.read)
+        {
+            auto& p = first[cursor.read];
+            if (!p)
+                continue;
+
+            p.try_inline();
+            if (cursor.write != cursor.read)
+                poly_v2::relocation::move(p, first[cursor.write]);
+            ++cursor.write;
+        }
+        return cursor.read == n;
+    }
+
+    // Container form: erases the empty tail and resets cursor when done.
+    template<typename Container>
+    bool compact(Container& c, size_t budget, compact_cursor& cursor)
+    {
+        if (!compact(c.begin(), c.end(), budget, cursor))
+            return false;
+
+        c.erase(c.begin() + cursor.write, c.end());
+        cursor = {};
+        return true;
+    }
+
+} // namespace poly
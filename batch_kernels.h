@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include "cpu.h"
+
+namespace poly
+{
+    // y = a * x + b. Stored in a task<float(float)>, thousands of these with
+    // different captures are evaluated eight at a time by task::invoke_batch
+    // when the CPU supports AVX2.
+    struct affine
+    {
+        float a = 1, b = 0;
+
+        float operator()(float x) const { return a * x + b; }
+
+        static void batch_invoke(const affine* const* fs, size_t n, float* out, const float* x)
+        {
+            static const auto kernel = cpu().avx2 ? &batch_avx2 : &batch_scalar;
+            kernel(fs, n, out, x);
+        }
+
+        static void batch_scalar(const affine* const* fs, size_t n, float* out, const float* x)
+        {
+            for (size_t i = 0; i < n; ++i)
+                out[i] = fs[i]->a * x[i] + fs[i]->b;
+        }
+
+        POLY_TARGET_AVX2
+        static void batch_avx2(const affine* const* fs, size_t n, float* out, const float* x)
+        {
+#if POLY_X86
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                // Pack the captures of eight tasks into lanes.
+                __m256 a = _mm256_setr_ps(
+                    fs[i + 0]->a, fs[i + 1]->a, fs[i + 2]->a, fs[i + 3]->a,
+                    fs[i + 4]->a, fs[i + 5]->a, fs[i + 6]->a, fs[i + 7]->a);
+                __m256 b = _mm256_setr_ps(
+                    fs[i + 0]->b, fs[i + 1]->b, fs[i + 2]->b, fs[i + 3]->b,
+                    fs[i + 4]->b, fs[i + 5]->b, fs[i + 6]->b, fs[i + 7]->b);
+                // Separate multiply and add round like the scalar a * x + b;
+                // a fused one would not give the same results.
+                _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(a, _mm256_loadu_ps(x + i)), b));
+            }
+            batch_scalar(fs + i, n - i, out + i, x + i);
+#else
+            batch_scalar(fs, n, out, x);
+#endif
+        }
+    };
+
+} // namespace poly
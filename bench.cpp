@@ -0,0 +1,411 @@
+// Micro benchmarks for the design choices made in the headers. Standalone,
+// e.g.
+//   g++ -std=c++17 -O2 -pthread bench.cpp -o bench && ./bench
+//
+// Each section prints a small table; absolute numbers depend on the machine,
+// the point is the crossovers.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "block_cache.h"
+#include "file_io.h"
+#include "logger.h"
+#include "relocate.h"
+#include "shard_runtime.h"
+#include "spsc_ring.h"
+#include "task_system.h"
+#include "unique_ptr_v2.h"
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+
+    // Runs fn until about budget has elapsed and returns the nanoseconds per call.
+    template<typename Fn>
+    double time_per_call(Fn&& fn, std::chrono::milliseconds budget = std::chrono::milliseconds(100))
+    {
+        size_t calls = 0;
+        auto start = clock_type::now();
+        auto end = start + budget;
+        auto now = start;
+        for (size_t batch = 1; now < end; batch *= 2)
+        {
+            for (size_t i = 0; i < batch; ++i)
+                fn();
+            calls += batch;
+            now = clock_type::now();
+        }
+        return std::chrono::duration<double, std::nano>(now - start).count() / calls;
+    }
+
+    // memcpy against the CPU dispatched streaming kernel. The buffers cycle
+    // through 256 MiB so that large copies come from and go to memory.
+    void bench_relocate_bytes()
+    {
+        std::printf("\n== relocate_bytes: memcpy vs streaming kernel (GB/s)\n");
+        std::printf("%10s %10s %10s\n", "bytes", "memcpy", "stream");
+
+        const size_t pool = size_t(256) << 20;
+        std::unique_ptr<char[]> src(new char[pool]), dst(new char[pool]);
+        std::memset(src.get(), 1, pool);
+        std::memset(dst.get(), 2, pool);
+
+        for (size_t n = 64; n <= (size_t(1) << 20); n *= 4)
+        {
+            size_t slots = pool / n, i = 0;
+            auto run = [&](poly::copy_kernel k) {
+                return time_per_call([&] {
+                    k(dst.get() + (i % slots) * n, src.get() + (i % slots) * n, n);
+                    ++i;
+                });
+            };
+            double m = run(&poly::copy_portable);
+            double s = run(poly::stream_copy());
+            std::printf("%10zu %10.2f %10.2f\n", n, n / m, n / s);
+        }
+    }
+
+    // Blocks allocated on one thread and freed on another, the pattern of a
+    // thread submitting spilled tasks to a worker.
+    template<typename Alloc, typename Free>
+    double cross_thread_ns(Alloc alloc, Free free, size_t count)
+    {
+        poly::spsc_ring<void*, 1024> ring;
+        std::atomic<bool> done{ false };
+        std::thread consumer([&] {
+            while (!done.load(std::memory_order_acquire) || !ring.empty())
+                if (!ring.consume([&](void*&& p) { free(p); }))
+                    std::this_thread::yield();
+        });
+
+        auto start = clock_type::now();
+        for (size_t i = 0; i < count; ++i)
+        {
+            void* p = alloc();
+            static_cast<char*>(p)[0] = char(i);
+            while (!ring.try_push(p))
+                std::this_thread::yield();
+        }
+        done.store(true, std::memory_order_release);
+        consumer.join();
+        return std::chrono::duration<double, std::nano>(clock_type::now() - start).count() / count;
+    }
+
+    template<size_t size>
+    void bench_block_cache_size()
+    {
+        using cache = poly::block_cache<size>;
+        const size_t count = 2000000;
+        double heap = cross_thread_ns([] { return ::operator new(size); }, [](void* p) { ::operator delete(p); }, count);
+        double cached = cross_thread_ns([] { return cache::allocate(); }, [](void* p) { cache::deallocate(p); }, count);
+        std::printf("%10zu %10.1f %10.1f\n", size, heap, cached);
+    }
+
+    void bench_block_cache()
+    {
+        std::printf("\n== block_cache: allocate on one thread, free on another (ns per block)\n");
+        std::printf("%10s %10s %10s\n", "bytes", "new", "cache");
+        bench_block_cache_size<64>();
+        bench_block_cache_size<256>();
+        bench_block_cache_size<1024>();
+    }
+
+    // Submitting tasks whose captures do not fit inline to a pool and
+    // running them there. The first column boxes the capture with new and
+    // keeps the task inline, the second lets the task spill it into its
+    // block_cache; the worker frees each block back to the submitting thread.
+    template<size_t size>
+    void bench_spilled_task_size()
+    {
+        struct blob { char bytes[size]; };
+        const size_t count = 500000;
+        std::atomic<size_t> ran{ 0 };
+        char last = 0;      // written by the single worker only
+
+        auto submit = [&](auto make) {
+            ran = 0;
+            auto start = clock_type::now();
+            {
+                poly::task_system ts(1);
+                for (size_t i = 0; i < count; ++i)
+                    ts.async_(make(i));
+                while (ran.load(std::memory_order_acquire) != count)
+                    std::this_thread::yield();
+            }
+            return std::chrono::duration<double, std::nano>(clock_type::now() - start).count() / count;
+        };
+
+        double boxed = submit([&](size_t i) {
+            auto b = std::make_unique<blob>();
+            b->bytes[0] = char(i);
+            return [&, b = std::move(b)] { last = b->bytes[0]; ran.fetch_add(1, std::memory_order_release); };
+        });
+        double spilled = submit([&](size_t i) {
+            blob b;
+            b.bytes[0] = char(i);
+            return [&, b] { last = b.bytes[0]; ran.fetch_add(1, std::memory_order_release); };
+        });
+        std::printf("%10zu %10.1f %10.1f\n", size, boxed, spilled);
+    }
+
+    void bench_spilled_task()
+    {
+        std::printf("\n== spilled tasks: submit to a task_system and run (ns per task)\n");
+        std::printf("%10s %10s %10s\n", "capture", "new", "cache");
+        bench_spilled_task_size<64>();
+        bench_spilled_task_size<256>();
+        bench_spilled_task_size<1024>();
+    }
+
+    struct payload_base
+    {
+        virtual ~payload_base() = default;
+        virtual char first() const = 0;
+    };
+
+    template<size_t size>
+    struct payload : payload_base
+    {
+        char bytes[size - sizeof(void*)] = {};
+        char first() const override { return bytes[0]; }
+    };
+
+    // An inline object costs a copy of itself on every move, a heap one costs
+    // an allocation up front and then a pointer steal per move. The last
+    // column is the number of moves per object above which the heap wins,
+    // which is what an inline_below<limit> threshold should be chosen from.
+    template<size_t size>
+    void bench_placement_size()
+    {
+        using inlined = poly_v2::unique_ptr<payload_base, 4096>;
+        using heap = poly_v2::unique_ptr<payload_base, 4096, poly_v2::inline_below<0>>;
+
+        auto create = [](auto p) {
+            return time_per_call([&] {
+                p.template emplace<payload<size>>();
+                p.reset();
+            });
+        };
+        auto move = [](auto a) {
+            a.template emplace<payload<size>>();
+            decltype(a) b;
+            return time_per_call([&] {
+                b = std::move(a);
+                a = std::move(b);
+            }) / 2;
+        };
+
+        double ci = create(inlined()), ch = create(heap());
+        double mi = move(inlined()), mh = move(heap());
+        char crossover[16] = "never";
+        if (mi > mh)
+            std::snprintf(crossover, sizeof(crossover), "%.0f", (ch - ci) / (mi - mh));
+        std::printf("%10zu %10.1f %10.1f %10.1f %10.1f %10s\n", size, ci, ch, mi, mh, crossover);
+    }
+
+    void bench_placement()
+    {
+        std::printf("\n== placement: inline vs heap unique_ptr (ns)\n");
+        std::printf("%10s %10s %10s %10s %10s %10s\n", "bytes", "new inl", "new heap", "move inl", "move heap", "moves");
+        bench_placement_size<16>();
+        bench_placement_size<64>();
+        bench_placement_size<256>();
+        bench_placement_size<1024>();
+        bench_placement_size<4000>();
+    }
+
+    uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    // Increments of random keys in a key value store. The sharded version
+    // gives each shard its own map and sends every increment to the owner of
+    // its key. The shared version runs the same increments on a task_system
+    // against one map behind a mutex. Work is generated in chunks by tasks
+    // on the executor itself, so no outside thread is on the hot path.
+    void bench_kv(unsigned threads)
+    {
+        const size_t ops = 1000000, chunk = 128, keys = 1 << 16;
+        const size_t chunks = ops / chunk;
+
+        double sharded;
+        {
+            std::vector<std::unordered_map<uint64_t, uint64_t>> maps(threads);
+            std::function<void(size_t)> generate;
+            auto start = clock_type::now();
+            {
+                poly::shard_runtime rt(threads);
+                generate = [&](size_t c) {
+                    for (size_t i = 0; i < chunk; ++i) {
+                        uint64_t key = mix(c * chunk + i) % keys;
+                        rt.submit_to(unsigned(key % threads), [&maps, key, &rt] { ++maps[rt.current_shard()][key]; });
+                    }
+                    if (c + threads < chunks)
+                        rt.submit_to(rt.current_shard(), [&generate, c, threads] { generate(c + threads); });
+                };
+                for (unsigned t = 0; t < threads; ++t)
+                    rt.submit_to(t, [&generate, t] { generate(t); });
+                // The destructor returns once every increment has run.
+            }
+            sharded = std::chrono::duration<double, std::nano>(clock_type::now() - start).count() / ops;
+        }
+
+        double shared;
+        {
+            std::unordered_map<uint64_t, uint64_t> map;
+            std::mutex mutex;
+            std::atomic<size_t> done{ 0 };
+            std::function<void(size_t)> generate;
+            auto start = clock_type::now();
+            {
+                poly::task_system ts(threads);
+                generate = [&](size_t c) {
+                    for (size_t i = 0; i < chunk; ++i) {
+                        uint64_t key = mix(c * chunk + i) % keys;
+                        ts.async_([&, key] {
+                            {
+                                std::lock_guard<std::mutex> lock(mutex);
+                                ++map[key];
+                            }
+                            done.fetch_add(1, std::memory_order_release);
+                        });
+                    }
+                    if (c + threads < chunks)
+                        ts.async_([&generate, c, threads] { generate(c + threads); });
+                };
+                for (unsigned t = 0; t < threads; ++t)
+                    ts.async_([&generate, t] { generate(t); });
+                while (done.load(std::memory_order_acquire) != chunks * chunk)
+                    std::this_thread::yield();
+            }
+            shared = std::chrono::duration<double, std::nano>(clock_type::now() - start).count() / ops;
+        }
+
+        std::printf("%10u %10.1f %10.1f\n", threads, sharded, shared);
+    }
+
+    void bench_kv()
+    {
+        std::printf("\n== kv: random increments, shard_runtime vs task_system + mutex (ns per op)\n");
+        std::printf("%10s %10s %10s\n", "threads", "sharded", "shared");
+        unsigned n = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned t = 1; t <= n; t *= 2)
+            bench_kv(t);
+        if ((n & (n - 1)) != 0)
+            bench_kv(n);
+    }
+
+    // Cost of one log() call on the calling thread. The records go to a null
+    // device; with overflow_policy::drop a full ring costs a counter
+    // increment, so the first column is the capture and push alone, the
+    // second includes waiting for the background thread when it falls
+    // behind.
+    template<typename Log>
+    void bench_logger_call(const char* name, Log&& log)
+    {
+        std::FILE* null = std::fopen(
+#if defined(_WIN32)
+            "NUL",
+#else
+            "/dev/null",
+#endif
+            "w");
+        double ns[2];
+        int i = 0;
+        for (auto policy : { poly::overflow_policy::drop, poly::overflow_policy::block })
+        {
+            poly::logger l(fileno(null), policy);
+            ns[i++] = time_per_call([&] { log(l); });
+        }
+        std::fclose(null);
+        std::printf("%24s %10.1f %10.1f\n", name, ns[0], ns[1]);
+    }
+
+    void bench_logger()
+    {
+        std::printf("\n== logger: ns per log() call\n");
+        std::printf("%24s %10s %10s\n", "arguments", "drop", "block");
+        int n = 0;
+        bench_logger_call("none", [](poly::logger& l) { l.log("request done"); });
+        bench_logger_call("int, double", [&](poly::logger& l) { l.log("request {} took {} ms", ++n, 1.5); });
+        bench_logger_call("int, short string", [&](poly::logger& l) { l.log("request {} from {}", ++n, "10.0.0.1"); });
+    }
+
+#if defined(__linux__)
+    // 4 KiB reads of a 64 MiB file, in order and at random offsets, kept
+    // depth requests deep. The file is written first, so it is read from the
+    // page cache and the numbers compare the submission paths rather than
+    // the disk.
+    void bench_file_io_pattern(std::FILE* f, bool random, bool use_io_uring, double& mbps)
+    {
+        const size_t block = 4096, blocks = (size_t(64) << 20) / block, depth = 32;
+        std::vector<char> buf(block * depth);
+        std::vector<uint64_t> order(blocks);
+        for (size_t i = 0; i < blocks; ++i)
+            order[i] = random ? mix(i) % blocks : i;
+
+        poly::file_io io(unsigned(depth), use_io_uring, 4);
+        size_t next = 0;
+        std::function<void(size_t)> issue = [&](size_t lane) {
+            if (next == blocks)
+                return;
+            uint64_t offset = order[next++] * block;
+            io.read(fileno(f), &buf[lane * block], unsigned(block), offset, [&issue, lane](int) { issue(lane); });
+        };
+
+        auto start = clock_type::now();
+        for (size_t lane = 0; lane < depth; ++lane)
+            issue(lane);
+        while (io.in_flight())
+            io.wait(1);
+        double s = std::chrono::duration<double>(clock_type::now() - start).count();
+        mbps = blocks * block / s / (1 << 20);
+    }
+
+    void bench_file_io()
+    {
+        std::printf("\n== file_io: 4 KiB reads at queue depth 32 (MiB/s)\n");
+        std::printf("%10s %10s %10s\n", "pattern", "io_uring", "pool");
+
+        std::FILE* f = std::tmpfile();
+        std::vector<char> chunk(size_t(1) << 20, 'x');
+        for (int i = 0; i < 64; ++i)
+            std::fwrite(chunk.data(), 1, chunk.size(), f);
+        std::fflush(f);
+
+        for (bool random : { false, true })
+        {
+            double uring = 0, pool = 0;
+            if (poly::file_io(1).uses_io_uring())
+                bench_file_io_pattern(f, random, true, uring);
+            bench_file_io_pattern(f, random, false, pool);
+            std::printf("%10s %10.0f %10.0f\n", random ? "random" : "sequential", uring, pool);
+        }
+        std::fclose(f);
+    }
+#endif
+}
+
+int main()
+{
+    bench_relocate_bytes();
+    bench_block_cache();
+    bench_spilled_task();
+    bench_placement();
+    bench_kv();
+    bench_logger();
+#if defined(__linux__)
+    bench_file_io();
+#endif
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace poly
+{
+    // Blocks are grouped into size classes of 16 bytes.
+    constexpr size_t size_class(size_t size) noexcept { return (size + 15) & ~size_t(15); }
+
+    // Per thread freelist of heap blocks of one size class. Each block
+    // remembers the thread that took it from the heap. A block freed on that
+    // thread goes back onto its local list. A block freed on any other thread
+    // is pushed onto the owner's lock-free remote list, which the owner takes
+    // over in one exchange the next time its local list runs dry.
+    //
+    // So in the common pattern of one thread creating tasks and a worker
+    // destroying them, the blocks flow back to the creating thread instead of
+    // piling up on the worker. Blocks freed locally beyond max_depth go back
+    // to the heap; returned blocks are kept, since there are never more of
+    // them than the thread had allocated at its peak. When a thread exits its
+    // cached blocks are freed, and blocks it still owns are freed directly by
+    // whoever releases them.
+    template<size_t block_size, size_t block_align = alignof(std::max_align_t)>
+    class block_cache
+    {
+        struct node { node* next; };
+
+        static_assert(block_size >= sizeof(node), "blocks must be able to hold a freelist link");
+
+        // Outlives its thread until every block it owns has gone back to the heap.
+        struct owner {
+            std::atomic<node*> remote{ nullptr };
+            std::atomic<size_t> refs{ 1 };      // the thread plus every owned block
+        };
+
+        // Each block is preceded by a header holding its owner.
+        static constexpr size_t header = block_align > sizeof(owner*) ? block_align : sizeof(owner*);
+
+        // Trivially destructible so it stays usable while other thread_local
+        // objects are destroyed.
+        struct cache {
+            node* head;
+            size_t depth;       // blocks of the list counted against max_depth, never more than its length
+            owner* self;
+            bool closed;
+        };
+
+        struct reaper {
+            cache& c;
+            ~reaper() {
+                free_list(c.head);
+                c.head = nullptr;
+                c.closed = true;
+                if (c.self) {
+                    free_list(c.self->remote.exchange(closed_marker(), std::memory_order_acquire));
+                    release(c.self);
+                    c.self = nullptr;
+                }
+            }
+        };
+
+        static node* closed_marker() noexcept { return reinterpret_cast<node*>(uintptr_t(1)); }
+
+        static owner*& owner_of(void* p) noexcept
+        {
+            return *reinterpret_cast<owner**>(static_cast<char*>(p) - header);
+        }
+
+        static cache& state() noexcept
+        {
+            thread_local cache c{};
+            thread_local reaper r{ c };
+            return c;
+        }
+
+        // The calling thread's cache, registering it as an owner on first use.
+        static cache& local()
+        {
+            cache& c = state();
+            if (!c.self && !c.closed)
+                c.self = new owner;
+            return c;
+        }
+
+        static void release(owner* o) noexcept
+        {
+            if (o->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete o;
+        }
+
+        static void* new_block(owner* o)
+        {
+            char* raw;
+            if constexpr (block_align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+                raw = static_cast<char*>(::operator new(header + block_size, std::align_val_t(block_align)));
+            else
+                raw = static_cast<char*>(::operator new(header + block_size));
+
+            void* p = raw + header;
+            owner_of(p) = o;
+            if (o)
+                o->refs.fetch_add(1, std::memory_order_relaxed);
+            return p;
+        }
+
+        static void free_block(void* p) noexcept
+        {
+            owner* o = owner_of(p);
+            char* raw = static_cast<char*>(p) - header;
+            if constexpr (block_align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+                ::operator delete(raw, std::align_val_t(block_align));
+            else
+                ::operator delete(raw);
+            if (o)
+                release(o);
+        }
+
+        static void free_list(node* n) noexcept
+        {
+            while (n) {
+                node* next = n->next;
+                free_block(n);
+                n = next;
+            }
+        }
+
+    public:
+        static constexpr size_t max_depth = 64;
+
+        static void* allocate()
+        {
+            cache& c = local();
+            if (c.closed)
+                return new_block(nullptr);
+
+            if (!c.head) {
+                // Take over every block other threads have returned. Their
+                // number is bounded by the peak number this thread had out,
+                // so they are not counted in depth.
+                c.head = c.self->remote.exchange(nullptr, std::memory_order_acquire);
+            }
+
+            if (node* n = c.head) {
+                // Taking a block frees room for a local one, whichever kind
+                // it was; depth stays zero while only returned blocks are left.
+                c.head = n->next;
+                if (c.depth)
+                    --c.depth;
+                return n;
+            }
+            return new_block(c.self);
+        }
+
+        static void deallocate(void* p) noexcept
+        {
+            owner* o = owner_of(p);
+            if (!o) {
+                free_block(p);
+                return;
+            }
+
+            cache& c = state();
+            if (o == c.self) {
+                if (c.depth == max_depth) {
+                    free_block(p);
+                    return;
+                }
+                c.head = new (p) node{ c.head };
+                ++c.depth;
+                return;
+            }
+
+            // Another thread's block: hand it back unless that thread has exited.
+            node* n = static_cast<node*>(p);
+            node* head = o->remote.load(std::memory_order_relaxed);
+            do {
+                if (head == closed_marker()) {
+                    free_block(p);
+                    return;
+                }
+                n->next = head;
+            } while (!o->remote.compare_exchange_weak(head, n, std::memory_order_release, std::memory_order_relaxed));
+        }
+    };
+
+} // namespace poly
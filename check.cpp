@@ -0,0 +1,1245 @@
+// Regression checks for behaviour main.cpp does not exercise. Standalone,
+// e.g.
+//   g++ -std=c++17 -O1 -pthread check.cpp -o check && ./check
+//
+// Prints each failed check and exits with the number of failures. The
+// concurrency checks are most useful built with -fsanitize=thread as well.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "algorithm.h"
+#include "batch_kernels.h"
+#include "block_cache.h"
+#include "command_buffer.h"
+#include "dispatch.h"
+#include "ecs.h"
+#include "file_io.h"
+#include "logger.h"
+#include "reactor.h"
+#include "reclaimer.h"
+#include "shard_runtime.h"
+#include "signal.h"
+#include "slot_map.h"
+#include "soa.h"
+#include "spsc_ring.h"
+#include "strand.h"
+#include "unique_ptr.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    int failures = 0;
+    bool fail_aligned_new = false;     // makes the next over-aligned allocation throw
+    std::atomic<long> aligned_live{ 0 };    // over-aligned allocations not yet freed
+
+#define CHECK(cond) \
+    do { if (!(cond)) { std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+    struct base
+    {
+        virtual ~base() = default;
+        virtual int id() const = 0;
+    };
+
+    struct small : base
+    {
+        explicit small(int v) : v(v) {}
+        int id() const override { return v; }
+        int v;
+    };
+
+    struct large : base
+    {
+        int id() const override { return 2; }
+        char bytes[1000] = {};
+    };
+
+    struct alignas(16) aligned_small : base
+    {
+        int id() const override { return 4; }
+    };
+
+    // The policy limits what require_inline accepts, not just the buffer.
+    static_assert(poly_v2::require_inline<aligned_small, base, 128, poly_v2::inline_below<64>>());
+
+    // A same type move must keep an inline object inline instead of moving
+    // it to the heap.
+    void check_v1_move_stays_local()
+    {
+        poly::unique_ptr<base> a;
+        a.emplace<small>(1);
+        CHECK(a.is_local());
+
+        poly::unique_ptr<base> b(std::move(a));
+        CHECK(b.is_local());
+        CHECK(b->id() == 1);
+        CHECK(!a);
+
+        poly::unique_ptr<base> c;
+        c = std::move(b);
+        CHECK(c.is_local());
+        CHECK(c->id() == 1);
+
+        std::vector<poly::unique_ptr<base>> v;
+        for (int i = 0; i < 100; ++i) {
+            v.emplace_back();
+            v.back().emplace<small>(i);
+        }
+        for (int i = 0; i < 100; ++i) {
+            CHECK(v[i].is_local());
+            CHECK(v[i]->id() == i);
+        }
+    }
+
+    // Objects above the inline limit stay on the heap, even through moves
+    // into buffers that could hold them.
+    void check_v1_inline_limit()
+    {
+        poly::unique_ptr<base, 10000, 256> a;
+        a.emplace<large>();
+        CHECK(!a.is_local());
+
+        poly::unique_ptr<base, 10000, 256> b(std::move(a));
+        CHECK(!b.is_local());
+
+        poly::unique_ptr<base, 10000> c(std::move(b));
+        CHECK(c.is_local());
+
+        poly::unique_ptr<base, 10000, 256> d(std::move(c));
+        CHECK(!d.is_local());
+        CHECK(d->id() == 2);
+
+        d.emplace<small>(3);
+        CHECK(d.is_local());
+
+        // The wrapper of an object at the limit is padded to its alignment.
+        poly::unique_ptr<base, 120, sizeof(aligned_small)> e, f;
+        e.emplace<aligned_small>();
+        CHECK(e.is_local());
+        f = std::move(e);
+        CHECK(f.is_local());
+        CHECK(f->id() == 4);
+    }
+
+    // A moved from buffer is empty and can be refilled and replayed.
+    void check_command_buffer_move()
+    {
+        int sum = 0;
+        poly::command_buffer<void(int)> a;
+        a.push([&](int x) { sum += x; });
+        a.push([&](int x) { sum += 2 * x; });
+
+        poly::command_buffer<void(int)> b(std::move(a));
+        CHECK(b.size() == 2);
+        CHECK(a.empty());
+        CHECK(a.capacity() == 0);
+
+        a.replay(1);
+        CHECK(sum == 0);
+        a.push([&](int x) { sum += 10 * x; });
+        a.replay(1);
+        CHECK(sum == 10);
+
+        b = std::move(a);
+        CHECK(b.size() == 1);
+        CHECK(a.empty());
+        b.replay(1);
+        CHECK(sum == 20);
+    }
+
+    // A small ring wraps around many times; elements arrive once each, in
+    // order, whether pushed one by one or staged and published in groups.
+    void check_spsc_ring_wraparound()
+    {
+        poly::spsc_ring<std::string, 8> ring;
+        const int count = 100000;
+        int next = 0, bad = 0;
+        std::thread consumer([&] {
+            while (next < count)
+                if (!ring.consume([&](std::string&& s) { bad += s != std::to_string(next++); }, 3))
+                    std::this_thread::yield();
+        });
+        for (int i = 0; i < count;) {
+            int group = i % 5 + 1;
+            int staged = 0;
+            while (staged < group && i + staged < count && ring.stage(std::to_string(i + staged)))
+                ++staged;
+            ring.publish();
+            if (staged == 0)
+                std::this_thread::yield();
+            i += staged;
+        }
+        consumer.join();
+        CHECK(next == count);
+        CHECK(bad == 0);
+        CHECK(ring.empty());
+    }
+
+    // Blocks taken over from other threads are kept, but local frees still
+    // stop caching at max_depth while some of them are on the list.
+    void check_block_cache_depth_after_takeover()
+    {
+        using cache = poly::block_cache<64, 64>;
+        const size_t blocks = 200, kept = 100;
+        std::thread([&] {
+            std::vector<void*> out;
+            for (size_t i = 0; i < blocks; ++i)
+                out.push_back(cache::allocate());
+            std::thread([&] { for (auto p : out) cache::deallocate(p); }).join();
+
+            long before = aligned_live;
+            for (size_t i = 0; i < blocks - kept; ++i)
+                out[i] = cache::allocate();
+            for (size_t i = 0; i < blocks - kept; ++i)
+                cache::deallocate(out[i]);
+            CHECK(size_t(before - aligned_live) == blocks - kept - cache::max_depth);
+        }).join();
+    }
+
+    std::atomic<int> reclaimed{ 0 };
+
+    struct counted
+    {
+        ~counted() { ++reclaimed; }
+    };
+
+    // Objects retired by threads that exit without flushing are destroyed.
+    void check_reclaimer_drains_exited_threads()
+    {
+        const int threads = 4, per_thread = 1000 + 7;
+        std::vector<std::thread> ts;
+        for (int t = 0; t < threads; ++t)
+            ts.emplace_back([] {
+                for (int i = 0; i < per_thread; ++i)
+                    poly::reclaimer::retire(new counted);
+            });
+        for (auto& t : ts)
+            t.join();
+        poly::reclaimer::synchronize();
+        CHECK(reclaimed == threads * per_thread);
+    }
+
+    size_t count_lines(std::FILE* f)
+    {
+        std::rewind(f);
+        size_t n = 0;
+        for (int c; (c = std::fgetc(f)) != EOF;)
+            n += c == '\n';
+        return n;
+    }
+
+    // Destroying a logger writes every record logged before, including those
+    // of threads that have exited and of loggers used alternately.
+    void check_logger_drains_on_shutdown()
+    {
+        std::FILE* a = std::tmpfile();
+        std::FILE* b = std::tmpfile();
+        {
+            poly::logger la(fileno(a)), lb(fileno(b));
+            for (int i = 0; i < 1000; ++i) {
+                la.log("a {}", i);
+                lb.log("b {}", i);
+            }
+
+            for (int round = 0; round < 3; ++round) {
+                std::vector<std::thread> threads;
+                for (int t = 0; t < 4; ++t)
+                    threads.emplace_back([&] {
+                        for (int i = 0; i < 5000; ++i)
+                            la.log("thread {}", i);
+                    });
+                for (auto& t : threads)
+                    t.join();
+            }
+        }
+        CHECK(count_lines(a) == 1000 + 3 * 4 * 5000);
+        CHECK(count_lines(b) == 1000);
+        std::fclose(a);
+        std::fclose(b);
+    }
+
+    // String arguments are copied when logged, so a buffer that is reused or
+    // goes away before the background thread formats the record still prints
+    // the text it held at the call.
+    void check_logger_copies_strings()
+    {
+        std::FILE* f = std::tmpfile();
+        {
+            poly::logger l(fileno(f));
+            char buf[16] = "first";
+            std::string s = "view";
+            char* null = nullptr;
+            l.log("{} {}", buf, static_cast<char*>(buf));
+            l.log("{} {}", std::string_view(s), null);
+            std::strcpy(buf, "second");
+            s = "gone";
+        }
+        std::rewind(f);
+        char line[64] = {};
+        CHECK(std::fgets(line, sizeof(line), f) && std::string(line) == "first first\n");
+        CHECK(std::fgets(line, sizeof(line), f) && std::string(line) == "view (null)\n");
+        std::fclose(f);
+    }
+
+    // Tasks run one at a time in post order, and a task can post to its own
+    // strand more times than any bounded queue would hold.
+    void check_strand_self_post()
+    {
+        poly::task_system ts(2);
+        const int producers = 3, per_producer = 2000, chain = 5000;
+        std::atomic<int> running{ 0 }, overlaps{ 0 }, chained{ 0 };
+        std::vector<int> last(producers, -1);
+        int out_of_order = 0;
+        std::function<void(int)> step;
+        {
+            poly::strand s(ts);
+
+            step = [&](int i) {
+                if (++chained, i + 1 < chain)
+                    s.post([&, i] { step(i + 1); });
+            };
+            s.post([&] { for (int i = 0; i < 10; ++i) s.post([] {}); step(0); });
+
+            std::vector<std::thread> threads;
+            for (int p = 0; p < producers; ++p)
+                threads.emplace_back([&, p] {
+                    for (int i = 0; i < per_producer; ++i)
+                        s.post([&, p, i] {
+                            if (running.fetch_add(1) != 0)
+                                ++overlaps;
+                            if (last[p] + 1 != i)
+                                ++out_of_order;
+                            last[p] = i;
+                            running.fetch_sub(1);
+                        });
+                });
+            for (auto& t : threads)
+                t.join();
+        }
+        CHECK(chained == chain);
+        CHECK(overlaps == 0);
+        CHECK(out_of_order == 0);
+        for (int p = 0; p < producers; ++p)
+            CHECK(last[p] == per_producer - 1);
+    }
+
+    // invoke_batch gives the same results as calling each task, whichever
+    // kernel the CPU selects.
+    void check_batch_invoke_matches_calls()
+    {
+        using fn = task<float(float)>;
+        const size_t n = 4096 + 5;
+        std::vector<fn> tasks;
+        std::vector<float> x(n), batch(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            tasks.emplace_back(poly::affine{ 1.0f / float(i + 3), float(i) * 0.37f - 100.0f });
+            x[i] = float(i) * 1.618f - 3000.0f;
+        }
+        fn::invoke_batch(tasks.data(), n, batch.data(), x.data());
+
+        size_t mismatched = 0;
+        for (size_t i = 0; i < n; ++i)
+            mismatched += batch[i] != tasks[i](x[i]);
+        CHECK(mismatched == 0);
+    }
+
+    // A posted callable is destroyed before ~strand returns, so its
+    // destructor may still use what the strand's owner is about to free.
+    struct slow_destructor
+    {
+        std::atomic<bool>* done;
+        explicit slow_destructor(std::atomic<bool>* d) : done(d) {}
+        slow_destructor(slow_destructor&& o) noexcept : done(std::exchange(o.done, nullptr)) {}
+        ~slow_destructor()
+        {
+            if (!done)
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            done->store(true);
+        }
+    };
+
+    void check_strand_destroys_tasks_before_returning()
+    {
+        poly::task_system ts(1);
+        std::atomic<bool> done{ false };
+        {
+            poly::strand s(ts);
+            s.post([d = slow_destructor(&done)] {});
+        }
+        CHECK(done);
+    }
+
+    // Destroying the runtime runs every message sent before, including the
+    // ones those messages send on to other shards.
+    void check_shard_runtime_quiescence()
+    {
+        std::atomic<int> ran{ 0 };
+        const int messages = 2000, hops = 4;
+        std::function<void(int)> hop;
+        {
+            poly::shard_runtime rt(3);
+            hop = [&](int left) {
+                ++ran;
+                if (left > 0)
+                    rt.submit_to((rt.current_shard() + 1) % rt.size(), [&hop, left] { hop(left - 1); });
+            };
+            for (int i = 0; i < messages; ++i)
+                rt.submit_to(i % rt.size(), [&hop] { hop(hops - 1); });
+        }
+        CHECK(ran == messages * hops);
+    }
+
+    struct component
+    {
+        virtual ~component() = default;
+    };
+
+    struct name : component
+    {
+        explicit name(std::string s) : s(std::move(s)) {}
+        std::string s;
+    };
+
+    struct position : component
+    {
+        position(float x, float y) : x(x), y(y) {}
+        float x, y;
+    };
+
+    // If the destination archetype can not grow, remove<U>() throws and the
+    // entity keeps its component.
+    void check_ecs_remove_is_exception_safe()
+    {
+        poly::world<component> w;
+        auto e = w.create(name("a long enough name to live on the heap"), position(1, 2));
+
+        fail_aligned_new = true;
+        bool threw = false;
+        try {
+            w.remove<name>(e);
+        }
+        catch (const std::bad_alloc&) {
+            threw = true;
+        }
+        fail_aligned_new = false;
+        CHECK(threw);
+        CHECK(w.has<name>(e));
+        CHECK(w.get<name>(e)->s == "a long enough name to live on the heap");
+
+        CHECK(w.remove<name>(e));
+        CHECK(!w.has<name>(e));
+        CHECK(w.get<position>(e)->y == 2);
+    }
+
+    struct shape
+    {
+        virtual ~shape() = default;
+    };
+
+    struct circle : shape {};
+    struct box : shape {};
+
+    // Dense type indices are usable while other statics are initialized.
+    const size_t early_circle_index = poly_v2::type_id<circle>::index();
+
+    // Objects set through a shape* reach their own overload, not the base one.
+    void check_dispatch_through_base_pointer()
+    {
+        CHECK(early_circle_index != 0);
+        CHECK(early_circle_index == poly_v2::type_id<circle>::index());
+
+        struct which {
+            int operator()(circle&, circle&) const { return 1; }
+            int operator()(circle&, box&) const { return 2; }
+            int operator()(box&, circle&) const { return 3; }
+            int operator()(box&, box&) const { return 4; }
+            int operator()(shape&, shape&) const { return 0; }
+        };
+
+        poly_v2::unique_ptr<shape> a, b;
+        a.emplace<circle>();
+        b.reset(static_cast<shape*>(new box));
+        CHECK(b.type() == nullptr);
+        CHECK((poly::dispatch2<poly::type_set<circle, box>>(a, b, which{}) == 2));
+        CHECK((poly::dispatch2<poly::type_set<circle, box>>(b, a, which{}) == 3));
+
+        poly::dispatcher2<shape, int> d;
+        d.add<circle, box>([](circle&, box&) { return 2; }, true);
+        d.set_fallback([](shape&, shape&) { return 0; });
+        CHECK(d(a, b) == 2);
+        CHECK(d(b, a) == 2);
+        CHECK(d(b, b) == 0);
+    }
+
+    uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    struct item
+    {
+        virtual ~item() = default;
+        virtual int key() const = 0;
+    };
+
+    struct keyed : item
+    {
+        keyed(int k, int tag) : k(k), tag(tag) {}
+        int key() const override { return k; }
+        int k, tag;
+    };
+
+    // Too large for a 128 byte buffer, so it is held on the heap.
+    struct big_keyed : keyed
+    {
+        using keyed::keyed;
+        char pad[256] = {};
+    };
+
+    using item_ptr = poly_v2::unique_ptr<item, 128>;
+
+    std::vector<item_ptr> make_items(int n)
+    {
+        std::vector<item_ptr> v(n);
+        for (int i = 0; i < n; ++i) {
+            int k = int(mix(uint64_t(i)) % 50);
+            if (i % 4 == 0)
+                v[i].emplace<big_keyed>(k, i);
+            else
+                v[i].emplace<keyed>(k, i);
+        }
+        return v;
+    }
+
+    int tag_of(const item_ptr& p) { return static_cast<const keyed*>(p.get())->tag; }
+
+    // Sort on a pointer larger than permute_threshold goes through
+    // apply_permutation; stable_partition, erase_if and compact relocate
+    // survivors in place and keep their order.
+    void check_relocating_algorithms()
+    {
+        auto by_key = [](const item_ptr& a, const item_ptr& b) { return a->key() < b->key(); };
+        static_assert(sizeof(item_ptr) > poly::permute_threshold, "exercise the permutation path");
+
+        auto v = make_items(200);
+        std::vector<int> keys;
+        for (auto& p : v)
+            keys.push_back(p->key());
+        std::sort(keys.begin(), keys.end());
+        poly::sort(v.begin(), v.end(), by_key);
+        for (size_t i = 0; i < v.size(); ++i)
+            CHECK(v[i]->key() == keys[i]);
+        for (auto& p : v)
+            CHECK(p.is_inlined() == (tag_of(p) % 4 != 0));
+
+        // An unqualified sort still means std::sort.
+        auto w = make_items(20);
+        sort(w.begin(), w.end(), by_key);
+        CHECK(std::is_sorted(w.begin(), w.end(), by_key));
+
+        v = make_items(200);
+        auto even = [](const item_ptr& p) { return p->key() % 2 == 0; };
+        auto mid = poly::stable_partition(v.begin(), v.end(), even);
+        CHECK(std::all_of(v.begin(), mid, even));
+        CHECK(std::none_of(mid, v.end(), even));
+        CHECK(std::is_sorted(v.begin(), mid, [](auto& a, auto& b) { return tag_of(a) < tag_of(b); }));
+        CHECK(std::is_sorted(mid, v.end(), [](auto& a, auto& b) { return tag_of(a) < tag_of(b); }));
+
+        v = make_items(200);
+        size_t threes = size_t(std::count_if(v.begin(), v.end(), [](auto& p) { return p->key() % 3 == 0; }));
+        CHECK(poly::erase_if(v, [](const item_ptr& p) { return p->key() % 3 == 0; }) == threes);
+        CHECK(v.size() == 200 - threes);
+        CHECK(std::none_of(v.begin(), v.end(), [](auto& p) { return !p || p->key() % 3 == 0; }));
+        CHECK(std::is_sorted(v.begin(), v.end(), [](auto& a, auto& b) { return tag_of(a) < tag_of(b); }));
+
+        v = make_items(200);
+        for (size_t i = 0; i < v.size(); i += 3)
+            v[i].reset();
+        poly::compact_cursor cursor;
+        int slices = 1;
+        while (!poly::compact(v, 7, cursor))
+            ++slices;
+        CHECK(slices == (200 + 6) / 7);
+        CHECK(v.size() == 200 - (200 + 2) / 3);
+        CHECK(std::all_of(v.begin(), v.end(), [](auto& p) { return bool(p); }));
+        CHECK(std::is_sorted(v.begin(), v.end(), [](auto& a, auto& b) { return tag_of(a) < tag_of(b); }));
+    }
+
+    // Large enough that a permutation of a few dozen is a streamed batch.
+    struct page
+    {
+        int tag;
+        char bytes[8192 - sizeof(int)];
+    };
+
+    using page_ptr = poly_v2::unique_ptr<page, sizeof(page) + 16>;
+
+    // Relocating a batch past POLY_STREAM_THRESHOLD goes through the streaming
+    // kernels and must still move every byte.
+    void check_streamed_relocation()
+    {
+        const int n = 64;
+        static_assert(n * sizeof(page_ptr) >= POLY_STREAM_THRESHOLD, "exercise the streaming path");
+        std::vector<page_ptr> v(n);
+        for (int i = 0; i < n; ++i) {
+            v[i].emplace<page>();
+            v[i]->tag = int(mix(uint64_t(i)) % 1000);
+            std::memset(v[i]->bytes, v[i]->tag, sizeof(page::bytes));
+        }
+        poly::sort(v.begin(), v.end(), [](const page_ptr& a, const page_ptr& b) { return a->tag < b->tag; });
+        poly::erase_if(v, [](const page_ptr& p) { return p->tag % 2 == 0; });
+
+        int bad = 0;
+        for (size_t i = 0; i < v.size(); ++i) {
+            bad += !v[i].is_inlined() || v[i]->tag % 2 == 0 || (i && v[i - 1]->tag > v[i]->tag);
+            for (char c : v[i]->bytes)
+                bad += c != char(v[i]->tag);
+        }
+        CHECK(bad == 0);
+    }
+
+    // Handlers connected during an emit first run in the next one; handlers
+    // disconnected during an emit, including the running one, are not called
+    // again, and stale connections are rejected.
+    void check_signal_reentrant_connections()
+    {
+        poly::signal<void(int)> s;
+        std::vector<int> calls;
+        poly::signal<void(int)>::connection a, b, c, d;
+
+        a = s.connect([&](int x) {
+            calls.push_back(1);
+            if (x == 0) {
+                CHECK(s.disconnect(b));
+                d = s.connect([&](int) { calls.push_back(4); });
+            }
+        });
+        b = s.connect([&](int) { calls.push_back(2); });
+        c = s.connect([&](int x) {
+            calls.push_back(3);
+            if (x == 1)
+                CHECK(s.disconnect(c));
+        });
+
+        s.emit(0);
+        CHECK((calls == std::vector<int>{ 1, 3 }));
+        CHECK(!s.connected(b));
+        CHECK(s.connected(d));
+        CHECK(s.size() == 3);
+
+        calls.clear();
+        s.emit(1);
+        CHECK(std::count(calls.begin(), calls.end(), 4) == 1);
+        CHECK(std::count(calls.begin(), calls.end(), 3) == 1);
+        CHECK(!s.connected(c));
+        CHECK(s.size() == 2);
+
+        calls.clear();
+        s.emit(2);
+        CHECK(calls.size() == 2 && std::count(calls.begin(), calls.end(), 3) == 0);
+
+        CHECK(!s.disconnect(b));
+        CHECK(!s.disconnect(c));
+
+        // A freed slot is reused with a new generation; the old handle stays stale.
+        auto e = s.connect([&](int) { calls.push_back(5); });
+        CHECK(e.index == b.index || e.index == c.index);
+        CHECK(!s.disconnect(e.index == b.index ? b : c));
+        CHECK(s.connected(e));
+
+        s.disconnect_all();
+        calls.clear();
+        s.emit(3);
+        CHECK(calls.empty());
+        CHECK(s.empty());
+    }
+
+    // Erase moves the last payload into the hole; every other handle keeps
+    // resolving to its own payload, and erased handles stop resolving even
+    // after their slot is reused.
+    void check_slot_map_stale_handles()
+    {
+        poly::slot_map<item, 128> m;
+        std::vector<poly::slot_map<item, 128>::handle> h;
+        for (int i = 0; i < 8; ++i) {
+            if (i % 3 == 0)
+                h.push_back(m.emplace<big_keyed>(i, i));
+            else
+                h.push_back(m.emplace<keyed>(i, i));
+        }
+
+        CHECK(m.erase(h[2]));
+        CHECK(m.erase(h[0]));
+        CHECK(!m.erase(h[2]));
+        CHECK(m.size() == 6);
+        CHECK(!m.contains(h[0]) && !m.find(h[0]) && !m.get(h[0]));
+        for (int i : { 1, 3, 4, 5, 6, 7 }) {
+            CHECK(m.contains(h[i]));
+            CHECK(m.get(h[i]) && m.get(h[i])->key() == i);
+        }
+        for (size_t i = 0; i < m.size(); ++i)
+            CHECK(m.get(m.handle_at(i)) == m[i].get());
+
+        auto reused = m.emplace<keyed>(100, 100);
+        CHECK(reused.index == h[0].index || reused.index == h[2].index);
+        CHECK(reused != h[0] && reused != h[2]);
+        CHECK(!m.get(h[0]) && !m.get(h[2]));
+        CHECK(m.get(reused)->key() == 100);
+
+        auto round_trip = poly::slot_map<item, 128>::handle::from_value(h[7].value());
+        CHECK(round_trip == h[7] && m.get(round_trip)->key() == 7);
+
+        m.clear();
+        CHECK(m.empty() && !m.contains(h[7]) && !m.contains(reused));
+    }
+
+    // Fits a 128 byte buffer but not a 32 byte one.
+    struct mid_keyed : keyed
+    {
+        using keyed::keyed;
+        char pad[64] = {};
+    };
+
+    // try_inline only moves heap objects that fit and may be inlined; the
+    // incremental compactions visit everything in slices and keep every
+    // payload intact.
+    void check_try_inline_and_compact()
+    {
+        item_ptr p;
+        p.emplace<keyed>(1, 1);
+        CHECK(p.is_inlined() && !p.try_inline());
+
+        p.emplace<big_keyed>(2, 2);
+        CHECK(!p.is_inlined() && !p.try_inline());
+        CHECK(p->key() == 2);
+
+        // Set through a pointer that asked to stay on the heap.
+        p.reset(new keyed(3, 3), true);
+        CHECK(!p.is_inlined() && !p.try_inline());
+        CHECK(p->key() == 3);
+
+        // A move from a smaller buffer inlines the object itself.
+        poly_v2::unique_ptr<item, 32> narrow;
+        narrow.emplace<mid_keyed>(4, 4);
+        CHECK(!narrow.is_inlined());
+        item_ptr wide(std::move(narrow));
+        CHECK(wide.is_inlined() && !wide.try_inline());
+        CHECK(wide->key() == 4);
+
+        poly::slot_map<item, 128> m;
+        std::vector<poly::slot_map<item, 128>::handle> h;
+        for (int i = 0; i < 20; ++i)
+            h.push_back(i % 2 ? m.emplace<keyed>(i, i) : m.emplace<big_keyed>(i, i));
+        int slices = 1;
+        while (!m.compact(6))
+            ++slices;
+        CHECK(slices == (20 + 5) / 6);
+        CHECK(m.compact(100));
+        for (int i = 0; i < 20; ++i)
+            CHECK(m.get(h[i])->key() == i && m.find(h[i])->is_inlined() == (i % 2 == 1));
+    }
+
+    std::atomic<int> destroyed{ 0 };
+    std::thread::id destroyed_on;
+
+    template<size_t pad>
+    struct destroy_tracked : item
+    {
+        int key() const override { return 0; }
+        ~destroy_tracked() override { destroyed_on = std::this_thread::get_id(); ++destroyed; }
+        char bytes[pad] = {};
+    };
+
+    // deferred_deleter hands heap objects to the reclaimer from reset(), move
+    // assignment and the destructor; inline objects die in place.
+    void check_deferred_deleter()
+    {
+        using deferred = poly_v2::unique_ptr<item, 64, poly_v2::deferred_deleter>;
+        poly::reclaimer::synchronize();
+        destroyed = 0;
+
+        deferred p;
+        p.emplace<destroy_tracked<8>>();
+        CHECK(p.is_inlined());
+        p.reset();
+        CHECK(destroyed == 1 && destroyed_on == std::this_thread::get_id());
+
+        p.emplace<destroy_tracked<256>>();
+        CHECK(!p.is_inlined());
+        p.reset();
+        deferred q;
+        q.emplace<destroy_tracked<256>>();
+        p.emplace<destroy_tracked<256>>();
+        p = std::move(q);           // retires the object p held
+        p.reset();
+        {
+            deferred r;
+            r.emplace<destroy_tracked<256>>();
+        }                           // retired by the destructor
+        poly::reclaimer::synchronize();
+        CHECK(destroyed == 5);
+        CHECK(destroyed_on != std::this_thread::get_id());
+
+        CHECK(poly::reclaimer::try_retire(new destroy_tracked<8>));
+        poly::reclaimer::synchronize();
+        CHECK(destroyed == 6);
+    }
+
+    // Heap held, and counts how often it is allocated.
+    struct counted_keyed : big_keyed
+    {
+        using big_keyed::big_keyed;
+        static inline int allocations = 0;
+        static void* operator new(size_t n) { ++allocations; return ::operator new(n); }
+        static void operator delete(void* p) { ::operator delete(p); }
+    };
+
+    // Same type moves are noexcept, keep inline objects inline and steal
+    // heap objects, so a vector of pointers grows without allocating or
+    // moving any object.
+    void check_v2_same_type_moves()
+    {
+        static_assert(std::is_nothrow_move_constructible_v<item_ptr>);
+        static_assert(std::is_nothrow_move_assignable_v<item_ptr>);
+        static_assert(std::is_nothrow_move_constructible_v<task<void()>>);
+
+        item_ptr a;
+        a.emplace<keyed>(1, 1);
+        item_ptr b(std::move(a));
+        CHECK(!a && b.is_inlined() && b->key() == 1);
+
+        a.emplace<big_keyed>(2, 2);
+        item* heap = a.get();
+        b = std::move(a);
+        CHECK(!a && !b.is_inlined() && b.get() == heap);
+
+        std::vector<item_ptr> v;
+        for (int i = 0; i < 100; ++i) {
+            v.emplace_back();
+            if (i % 10 == 0)
+                v.back().emplace<counted_keyed>(i, i);
+            else
+                v.back().emplace<keyed>(i, i);
+        }
+        CHECK(counted_keyed::allocations == 10);
+        std::vector<item*> heap_objects;
+        for (auto& p : v)
+            if (!p.is_inlined())
+                heap_objects.push_back(p.get());
+
+        v.reserve(v.capacity() * 4);
+        CHECK(counted_keyed::allocations == 10);
+
+        size_t h = 0;
+        for (int i = 0; i < 100; ++i) {
+            CHECK(v[i]->key() == i);
+            CHECK(v[i].is_inlined() == (i % 10 != 0));
+            if (i % 10 == 0)
+                CHECK(v[i].get() == heap_objects[h++]);
+        }
+    }
+
+    // no_spill pointers only ever hold inline objects: moves from pointers
+    // that may spill go through try_assign, which refuses objects that do
+    // not fit and leaves both sides untouched.
+    void check_no_spill()
+    {
+        using inline_ptr = poly_v2::unique_ptr<item, 128, poly_v2::no_spill>;
+        inline_ptr a;
+        a.emplace<keyed>(1, 1);
+        CHECK(a.is_inlined());
+
+        // A no_spill source with a smaller buffer always fits.
+        poly_v2::unique_ptr<item, 32, poly_v2::no_spill> narrow;
+        narrow.emplace<keyed>(2, 2);
+        a = std::move(narrow);
+        CHECK(a.is_inlined() && a->key() == 2);
+
+        item_ptr big;
+        big.emplace<big_keyed>(3, 3);
+        CHECK(!a.try_assign(std::move(big)));
+        CHECK(big && big->key() == 3);
+        CHECK(a && a->key() == 2);
+
+        item_ptr small;
+        small.emplace<keyed>(4, 4);
+        CHECK(a.try_assign(std::move(small)));
+        CHECK(a.is_inlined() && a->key() == 4);
+
+        // task's counterpart: inline_only does not compile for a callable
+        // that would spill.
+        int x = 5;
+        task<int()> t(inline_only, [x] { return x; });
+        CHECK(t() == 5);
+    }
+
+    // is<U>() matches the exact stored type through its tag, and through
+    // typeid for objects only known by a base pointer.
+    void check_type_identity()
+    {
+        item_ptr p;
+        CHECK(!p.is<keyed>() && p.type() == nullptr);
+
+        p.emplace<keyed>(1, 1);
+        CHECK(p.is<keyed>() && !p.is<big_keyed>() && !p.is<item>());
+        CHECK(p.type() == &poly_v2::type_id<keyed>::tag);
+        CHECK(p.type()->info() == typeid(keyed));
+
+        p.emplace<big_keyed>(2, 2);
+        CHECK(p.is<big_keyed>() && !p.is<keyed>());
+        CHECK(p.type() == &poly_v2::type_id<big_keyed>::tag);
+        CHECK(p.type()->index() != poly_v2::type_id<keyed>::tag.index());
+        CHECK(p.type()->index() == poly_v2::type_id<big_keyed>::tag.index());
+
+        // Set through a keyed* to a big_keyed: no exact tag, typeid decides.
+        keyed* k = new big_keyed(3, 3);
+        p.reset(k);
+        CHECK(p.type() == nullptr);
+        CHECK(p.is<big_keyed>() && !p.is<keyed>());
+    }
+
+    // Finds keyed through its declared bases instead of dynamic_cast.
+    struct leaf_keyed : keyed
+    {
+        using keyed::keyed;
+    };
+}
+
+template<> struct poly_v2::bases<leaf_keyed> { using type = std::tuple<keyed>; };
+
+namespace
+{
+    // get_if<U>() only returns exact matches; get_as<U>() also converts to
+    // bases, declared or found with RTTI; release<U>() hands over the object
+    // only if it is a U, and then leaves the pointer empty.
+    void check_checked_downcasts()
+    {
+        item_ptr p;
+        CHECK(!p.get_if<keyed>() && !p.get_as<keyed>() && !p.release<keyed>());
+
+        p.emplace<leaf_keyed>(1, 1);
+        const item_ptr& cp = p;
+        CHECK(p.get_if<leaf_keyed>() == p.get() && cp.get_if<leaf_keyed>() == p.get());
+        CHECK(!p.get_if<keyed>());
+        CHECK(p.get_as<keyed>() == static_cast<keyed*>(p.get_if<leaf_keyed>()));
+        CHECK(cp.get_as<item>() == p.get());
+
+        p.emplace<big_keyed>(2, 2);
+        CHECK(!p.get_if<keyed>() && p.get_as<keyed>() && p.get_as<keyed>()->k == 2);
+        CHECK(!p.get_as<leaf_keyed>());
+
+        CHECK(!p.release<leaf_keyed>());
+        CHECK(p && p->key() == 2);
+        item* heap = p.get();
+        keyed* released = p.release<keyed>();
+        CHECK(released == heap && !p);
+        delete released;
+
+        // An inline object is moved to the heap to be released.
+        p.emplace<keyed>(3, 3);
+        std::unique_ptr<keyed> owned(p.release<keyed>());
+        CHECK(owned && owned->k == 3 && !p);
+    }
+
+    struct particle_hot { float x = 0, vx = 1; };
+
+    // The cold part of a particle; its hot members live in soa_vector columns.
+    struct particle : keyed
+    {
+        using keyed::keyed;
+    };
+}
+
+template<> struct poly_v2::hot_members<particle> {
+    static constexpr auto value = std::make_tuple(&particle_hot::x, &particle_hot::vx);
+};
+
+namespace
+{
+    // Hot members are stored only in the columns, which stay in step with
+    // the objects through emplace_back() and erase().
+    void check_soa_hot_columns()
+    {
+        static_assert(std::is_same_v<poly_v2::soa_vector<particle, item>::hot_type, particle_hot>);
+        static_assert(std::is_same_v<poly_v2::soa_vector<keyed, item>::hot_type, poly_v2::no_hot_members>);
+
+        poly_v2::soa_vector<particle, item> v;
+        for (int i = 0; i < 8; ++i)
+        {
+            CHECK(v.emplace_back(i, i) == size_t(i));
+            CHECK(v.hot<0>(i) == 0 && v.hot<1>(i) == 1);
+            v.hot<0>(i) = float(i);
+        }
+
+        // Writes through a column are visible at once and are not copied anywhere.
+        float* x = v.column<0>();
+        const float* vx = v.column<1>();
+        for (size_t i = 0; i < v.size(); ++i)
+            x[i] += vx[i];
+        CHECK(v.column<0>() == x && &v.hot<0>(3) == x + 3);
+        for (int i = 0; i < 8; ++i)
+            CHECK(v.hot<0>(i) == i + 1 && v.load_hot(i).x == i + 1);
+
+        v.store_hot(2, particle_hot{ 20, 2 });
+        CHECK(v.hot<0>(2) == 20 && v.hot<1>(2) == 2);
+
+        // The last element moves into the hole, with its hot members.
+        v.erase(2);
+        CHECK(v.size() == 7 && v.get(2)->key() == 7 && v.hot<0>(2) == 8);
+        v.erase(6);
+        CHECK(v.size() == 6 && v.get(5)->key() == 5 && v.hot<0>(5) == 6);
+        for (size_t i = 0; i < v.size(); ++i)
+            CHECK(v.hot<0>(i) == v.get(i)->key() + 1);
+
+        poly_v2::soa_collection<item, particle, keyed> c;
+        c.emplace_back<particle>(1, 1);
+        c.emplace_back<keyed>(2, 2);
+        c.of<particle>().hot<0>(0) = 5;
+        int sum = 0;
+        c.for_each([&](item& it) { sum += it.key(); });
+        CHECK(c.size() == 2 && sum == 3 && c.of<particle>().hot<0>(0) == 5);
+
+        v.clear();
+        CHECK(v.empty());
+    }
+
+#if defined(__linux__)
+    // A stop() that happens before run() is not lost, and is consumed by it.
+    void check_reactor_early_stop()
+    {
+        poly::reactor r;
+        int ran = 0;
+        std::thread t([&] {
+            r.post([&] { ++ran; });
+            r.stop();
+        });
+        t.join();
+        r.run();            // returns instead of waiting forever
+        CHECK(ran == 0);
+
+        r.post([&] { ++ran; r.stop(); });
+        r.run();            // runs both posted tasks, then stops again
+        CHECK(ran == 2);
+    }
+
+    struct pipe_fds
+    {
+        int fd[2];
+        pipe_fds() { CHECK(::pipe2(fd, O_NONBLOCK | O_CLOEXEC) == 0); }
+        ~pipe_fds() { ::close(fd[0]); ::close(fd[1]); }
+        void write() { (void)!::write(fd[1], "x", 1); }
+        void drain() { char buf[64]; while (::read(fd[0], buf, sizeof(buf)) > 0) {} }
+    };
+
+    struct throws_on_copy
+    {
+        throws_on_copy() = default;
+        throws_on_copy(const throws_on_copy&) { throw std::runtime_error("copy"); }
+        void operator()(uint32_t) {}
+    };
+
+    // Handlers run on readiness until removed. A handler may replace itself,
+    // and an add whose handler cannot be constructed leaves the fd
+    // unregistered.
+    void check_reactor_handlers()
+    {
+        poly::reactor r;
+        pipe_fds a, b;
+        int first = 0, second = 0, other = 0;
+
+        r.add(a.fd[0], EPOLLIN, [&](uint32_t events) {
+            CHECK(events & EPOLLIN);
+            a.drain();
+            ++first;
+            // Replace this handler; the one running finishes undisturbed.
+            r.remove(a.fd[0]);
+            r.add(a.fd[0], EPOLLIN, [&](uint32_t) { a.drain(); ++second; });
+            CHECK(first == 1);
+        });
+        r.add(b.fd[0], EPOLLIN, [&](uint32_t) { b.drain(); ++other; });
+
+        a.write();
+        CHECK(r.run_once(1000) == 1);
+        CHECK(first == 1 && second == 0);
+        a.write();
+        b.write();
+        while (second + other < 2 && r.run_once(1000)) {}
+        CHECK(first == 1 && second == 1 && other == 1);
+
+        r.remove(b.fd[0]);
+        b.write();
+        CHECK(r.run_once(0) == 0);
+        CHECK(other == 1);
+
+        throws_on_copy bad;
+        bool threw = false;
+        try {
+            r.add(b.fd[0], EPOLLIN, bad);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+        r.add(b.fd[0], EPOLLIN, [&](uint32_t) { b.drain(); ++other; });
+        CHECK(r.run_once(1000) == 1);
+        CHECK(other == 2);
+    }
+
+    // Periodic timers fire until cancelled, one shot timers once.
+    void check_reactor_timers()
+    {
+        using std::chrono::milliseconds;
+        poly::reactor r;
+        int ticks = 0, once = 0, id = -1;
+        id = r.add_timer(milliseconds(1), milliseconds(1), [&] {
+            if (++ticks == 3)
+                r.cancel_timer(id);
+        });
+        r.add_timer(milliseconds(2), milliseconds(0), [&] { ++once; });
+        auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while ((ticks < 3 || once < 1) && std::chrono::steady_clock::now() < end)
+            r.run_once(100);
+        r.run_once(20);
+        CHECK(ticks == 3);
+        CHECK(once == 1);
+    }
+
+    // Offloaded work runs on the executor, its continuation on the reactor thread.
+    void check_reactor_offload()
+    {
+        poly::reactor r;
+        int result = 0, done = 0;
+        auto loop = std::this_thread::get_id();
+        {
+            poly::task_system ts(2);
+            r.offload(ts, [] { return 42; }, [&](int v) {
+                CHECK(std::this_thread::get_id() == loop);
+                result = v;
+                ++done;
+            });
+            r.offload(ts, [] {}, [&] {
+                CHECK(std::this_thread::get_id() == loop);
+                ++done;
+            });
+            auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (done < 2 && std::chrono::steady_clock::now() < end)
+                r.run_once(100);
+        }
+        CHECK(result == 42);
+        CHECK(done == 2);
+    }
+
+    // Continuations may call poll() and issue more I/O; every request still
+    // completes exactly once.
+    void check_file_io_reentrant_poll(bool use_io_uring)
+    {
+        std::FILE* f = std::tmpfile();
+        std::vector<char> data(64 * 1024);
+        for (size_t i = 0; i < data.size(); ++i)
+            data[i] = char(i / 4096);
+        std::fwrite(data.data(), 1, data.size(), f);
+        std::fflush(f);
+        int fd = fileno(f);
+
+        const int blocks = int(data.size() / 4096), rounds = 3;
+        std::vector<char> buf(data.size());
+        std::vector<int> completions(blocks);
+        int bad = 0;
+        {
+            poly::file_io io(8, use_io_uring, 2);
+            std::function<void(int, int)> read_block = [&](int b, int round) {
+                io.read(fd, &buf[b * 4096], 4096, uint64_t(b) * 4096, [&, b, round](int result) {
+                    ++completions[b];
+                    if (result != 4096 || buf[b * 4096] != char(b))
+                        ++bad;
+                    io.poll();
+                    if (round + 1 < rounds)
+                        read_block(b, round + 1);
+                });
+            };
+            for (int b = 0; b < blocks; ++b)
+                read_block(b, 0);
+            while (io.in_flight())
+                io.wait(1);
+        }
+        for (int b = 0; b < blocks; ++b)
+            CHECK(completions[b] == rounds);
+        CHECK(bad == 0);
+        std::fclose(f);
+    }
+#endif
+}
+
+// Aligned allocations go through here so that a check can make one fail.
+void* operator new(std::size_t n, std::align_val_t al)
+{
+    if (fail_aligned_new) {
+        fail_aligned_new = false;
+        throw std::bad_alloc();
+    }
+    size_t a = size_t(al);
+    if (void* p = std::aligned_alloc(a, (n + a - 1) / a * a)) {
+        ++aligned_live;
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* p, std::align_val_t) noexcept { --aligned_live; std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { --aligned_live; std::free(p); }
+
+int main()
+{
+    check_v1_move_stays_local();
+    check_v1_inline_limit();
+    check_command_buffer_move();
+    check_spsc_ring_wraparound();
+    check_block_cache_depth_after_takeover();
+    check_reclaimer_drains_exited_threads();
+    check_logger_drains_on_shutdown();
+    check_logger_copies_strings();
+    check_batch_invoke_matches_calls();
+    check_strand_self_post();
+    check_strand_destroys_tasks_before_returning();
+    check_shard_runtime_quiescence();
+    check_ecs_remove_is_exception_safe();
+    check_dispatch_through_base_pointer();
+    check_relocating_algorithms();
+    check_streamed_relocation();
+    check_signal_reentrant_connections();
+    check_slot_map_stale_handles();
+    check_try_inline_and_compact();
+    check_deferred_deleter();
+    check_v2_same_type_moves();
+    check_no_spill();
+    check_type_identity();
+    check_checked_downcasts();
+    check_soa_hot_columns();
+#if defined(__linux__)
+    check_reactor_early_stop();
+    check_reactor_handlers();
+    check_reactor_timers();
+    check_reactor_offload();
+    check_file_io_reentrant_poll(true);
+    check_file_io_reentrant_poll(false);
+#endif
+
+    if (failures == 0)
+        std::printf("all checks passed\n");
+    return failures;
+}
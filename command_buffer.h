@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace poly
+{
+    template <class>
+    class command_buffer;
+
+    // Records callables back to back in chunked linear memory and replays
+    // them in order. Each record is a pointer to the concept of its callable
+    // followed by the callable itself at its natural size and alignment, so
+    // there is no fixed slot size and nothing spills to the heap.
+    //
+    // clear() destroys every record but keeps the chunks, so a buffer that is
+    // refilled every frame stops allocating once it has reached its peak size.
+    template <class... Args>
+    class command_buffer<void(Args...)>
+    {
+        struct concept {
+            // Both return the end of the record.
+            char*(*_invoke)(char*, Args&...);
+            char*(*_dtor)(char*) noexcept;
+        };
+
+        template <class F>
+        struct model {
+            static F* payload(char* record) noexcept {
+                auto p = reinterpret_cast<uintptr_t>(record + sizeof(const concept*));
+                return reinterpret_cast<F*>((p + alignof(F) - 1) & ~uintptr_t(alignof(F) - 1));
+            }
+            static char* end(F* f) noexcept {
+                auto p = reinterpret_cast<uintptr_t>(f + 1);
+                constexpr auto a = alignof(const concept*);
+                return reinterpret_cast<char*>((p + a - 1) & ~uintptr_t(a - 1));
+            }
+
+            static char* _invoke(char* record, Args&... args) {
+                F* f = payload(record);
+                (*f)(args...);
+                return end(f);
+            }
+            static char* _dtor(char* record) noexcept {
+                F* f = payload(record);
+                f->~F();
+                return end(f);
+            }
+
+            // Upper bound of the record size, whatever the alignment of its start.
+            static constexpr size_t max_size =
+                sizeof(const concept*) + alignof(F) - 1 + sizeof(F) + alignof(const concept*) - 1;
+
+            static constexpr concept vtable{ _invoke, _dtor };
+        };
+
+        struct chunk {
+            std::unique_ptr<char[]> data;
+            size_t capacity = 0;
+            size_t used = 0;
+        };
+
+        size_t _chunk_size;
+        std::vector<chunk> _chunks;
+        size_t _current = 0;    // index of the chunk being appended to
+        size_t _count = 0;
+
+        // Returns a chunk with at least n free bytes, moving on to (or
+        // allocating) the next one when the current chunk is full.
+        chunk& reserve(size_t n)
+        {
+            while (_current < _chunks.size())
+            {
+                auto& c = _chunks[_current];
+                if (c.capacity - c.used >= n)
+                    return c;
+                if (_current + 1 == _chunks.size())
+                    break;
+                ++_current;
+            }
+
+            chunk c;
+            c.capacity = n > _chunk_size ? n : _chunk_size;
+            c.data.reset(new char[c.capacity]);
+            _chunks.push_back(std::move(c));
+            _current = _chunks.size() - 1;
+            return _chunks.back();
+        }
+
+        template <class Fn>
+        void for_each_record(Fn fn)
+        {
+            for (size_t i = 0; i < _chunks.size() && i <= _current; ++i)
+            {
+                char* p = _chunks[i].data.get();
+                char* end = p + _chunks[i].used;
+                while (p < end)
+                    p = fn(p, *reinterpret_cast<const concept**>(p));
+            }
+        }
+
+    public:
+        explicit command_buffer(size_t chunk_size = 64 * 1024) : _chunk_size(chunk_size) {}
+
+        ~command_buffer() { clear(); }
+
+        // x is left empty, without chunks.
+        command_buffer(command_buffer&& x) noexcept
+            : _chunk_size(x._chunk_size)
+            , _chunks(std::exchange(x._chunks, {}))
+            , _current(std::exchange(x._current, 0))
+            , _count(std::exchange(x._count, 0))
+        {}
+
+        command_buffer& operator=(command_buffer&& x) noexcept {
+            if (this != &x) {
+                clear();
+                _chunk_size = x._chunk_size;
+                _chunks = std::exchange(x._chunks, {});
+                _current = std::exchange(x._current, 0);
+                _count = std::exchange(x._count, 0);
+            }
+            return *this;
+        }
+
+        template <class F>
+        void push(F&& f)
+        {
+            using D = std::decay_t<F>;
+            static_assert(alignof(D) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "over aligned callables are not supported");
+
+            auto& c = reserve(model<D>::max_size);
+            char* record = c.data.get() + c.used;
+            D* payload = new (model<D>::payload(record)) D(std::forward<F>(f));
+            *reinterpret_cast<const concept**>(record) = &model<D>::vtable;
+            c.used = model<D>::end(payload) - c.data.get();
+            ++_count;
+        }
+
+        // Invokes every recorded callable in the order they were pushed.
+        void replay(Args... args)
+        {
+            for_each_record([&](char* p, const concept* c) { return c->_invoke(p, args...); });
+        }
+
+        // Destroys every record. The memory is kept for reuse.
+        void clear() noexcept
+        {
+            for_each_record([](char* p, const concept* c) { return c->_dtor(p); });
+            for (auto& c : _chunks)
+                c.used = 0;
+            _current = 0;
+            _count = 0;
+        }
+
+        size_t size() const noexcept { return _count; }
+        bool empty() const noexcept { return _count == 0; }
+
+        // Bytes of chunk memory owned by the buffer.
+        size_t capacity() const noexcept
+        {
+            size_t n = 0;
+            for (auto& c : _chunks)
+                n += c.capacity;
+            return n;
+        }
+    };
+
+} // namespace poly
@@ -0,0 +1,67 @@
+#pragma once
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define POLY_X86 1
+#define POLY_TARGET_AVX2
+#define POLY_TARGET_AVX512
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define POLY_X86 1
+#define POLY_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define POLY_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define POLY_X86 0
+#define POLY_TARGET_AVX2
+#define POLY_TARGET_AVX512
+#endif
+
+namespace poly
+{
+    // Instruction sets usable on this machine, detected once through CPUID.
+    struct cpu_features {
+        bool avx2 = false;
+        bool avx512f = false;
+    };
+
+    namespace detail
+    {
+        inline cpu_features detect_cpu_features() noexcept
+        {
+            cpu_features f;
+#if POLY_X86 && defined(_MSC_VER)
+            int regs[4];
+            __cpuid(regs, 0);
+            if (regs[0] < 7)
+                return f;
+
+            __cpuid(regs, 1);
+            bool osxsave = (regs[2] & (1 << 27)) != 0;
+            bool fma = (regs[2] & (1 << 12)) != 0;
+            if (!osxsave)
+                return f;
+
+            // The OS must save the ymm (and zmm) registers on context switch.
+            auto xcr0 = _xgetbv(0);
+            bool ymm = (xcr0 & 0x6) == 0x6;
+            bool zmm = (xcr0 & 0xe6) == 0xe6;
+
+            __cpuidex(regs, 7, 0);
+            f.avx2 = ymm && fma && (regs[1] & (1 << 5)) != 0;
+            f.avx512f = zmm && (regs[1] & (1 << 16)) != 0;
+#elif POLY_X86
+            __builtin_cpu_init();
+            f.avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+            f.avx512f = __builtin_cpu_supports("avx512f");
+#endif
+            return f;
+        }
+    }
+
+    inline const cpu_features& cpu() noexcept
+    {
+        static const cpu_features features = detail::detect_cpu_features();
+        return features;
+    }
+
+} // namespace poly
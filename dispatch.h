@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "task.h"
+#include "unique_ptr_v2.h"
+
+// Double dispatch on the concrete types of two poly_v2::unique_ptr objects,
+// using the type tag of each concept table instead of dynamic_cast chains.
+namespace poly
+{
+    // The closed set of concrete types dispatch2 resolves.
+    template<typename... Us>
+    struct type_set {};
+
+    namespace detail
+    {
+        template<typename Set>
+        struct closed_dispatch;
+
+        template<typename... Us>
+        struct closed_dispatch<type_set<Us...>>
+        {
+            static constexpr size_t size = sizeof...(Us);
+
+            // Position in Us... of each dense type index, size if absent.
+            static std::vector<uint16_t> build()
+            {
+                size_t n = 0;
+                ((n = std::max(n, poly_v2::type_id<Us>::index() + 1)), ...);
+                std::vector<uint16_t> table(n, uint16_t(size));
+                uint16_t i = 0;
+                ((table[poly_v2::type_id<Us>::index()] = i++), ...);
+                return table;
+            }
+
+            // Position in Us... of the dynamic type of an object that has no
+            // tag because it was set through a base pointer.
+            static size_t position(const std::type_info& info) noexcept
+            {
+                size_t i = 0;
+                (void)((info == typeid(Us) || (++i, false)) || ...);
+                return i;
+            }
+
+            template<typename T, size_t N, typename P>
+            static size_t position(const poly_v2::unique_ptr<T, N, P>& p)
+            {
+                if (const poly_v2::type_tag* tag = p.type())
+                {
+                    static const std::vector<uint16_t> table = build();
+                    size_t index = tag->index();
+                    return index < table.size() ? table[index] : size;
+                }
+                if constexpr (std::is_polymorphic_v<T>)
+                {
+                    if (p)
+                        return position(typeid(*p.get()));
+                }
+                return size;
+            }
+
+            template<typename T, typename R, typename Fn, typename A, typename B>
+            static R invoke(Fn& fn, T* a, T* b)
+            {
+                return static_cast<R>(fn(static_cast<A&>(*a), static_cast<B&>(*b)));
+            }
+
+            template<typename T, typename R, typename Fn>
+            struct table
+            {
+                using entry = R(*)(Fn&, T*, T*);
+
+                template<typename A>
+                static constexpr std::array<entry, size> row{ &invoke<T, R, Fn, A, Us>... };
+
+                static constexpr std::array<std::array<entry, size>, size> entries{ row<Us>... };
+            };
+
+            template<typename T, typename A, typename B, typename Fn>
+            static decltype(auto) run(A& a, B& b, Fn& fn)
+            {
+                using first = std::tuple_element_t<0, std::tuple<Us...>>;
+                using R = std::invoke_result_t<Fn&, first&, first&>;
+
+                size_t i = position(a);
+                size_t j = position(b);
+                if (i < size && j < size)
+                    return table<T, R, Fn>::entries[i][j](fn, a.get(), b.get());
+
+                if constexpr (std::is_invocable_v<Fn&, T&, T&>)
+                {
+                    if (a && b)
+                        return static_cast<R>(fn(*a.get(), *b.get()));
+                }
+                throw std::invalid_argument("poly::dispatch2: type not in the set");
+            }
+        };
+
+        struct tag_pair_hash {
+            size_t operator()(const std::pair<const poly_v2::type_tag*, const poly_v2::type_tag*>& p) const noexcept
+            {
+                auto a = reinterpret_cast<uintptr_t>(p.first);
+                auto b = reinterpret_cast<uintptr_t>(p.second);
+                return std::hash<uintptr_t>()(a ^ (b * 0x9E3779B97F4A7C15ull));
+            }
+        };
+    }
+
+    // Calls fn(A&, B&) where A and B are the concrete types of *a and *b, with
+    // one indexed call through a table generated for the types in Set, e.g.
+    //
+    //   poly::dispatch2<poly::type_set<circle, box>>(a, b, overloaded{
+    //       [](circle&, circle&) { ... },
+    //       [](circle&, box&) { ... },
+    //       [](shape&, shape&) { ... } });
+    //
+    // Every pair in Set must be callable, so a fallback overload taking base
+    // references covers the pairs without a dedicated one. If either object is
+    // empty or its type is not in Set, calls fn(T&, T&) when that is valid and
+    // throws std::invalid_argument otherwise. The types must not be virtual
+    // bases of T. An object set through a base pointer carries no type tag
+    // and is looked up by its typeid instead, which is slower but still finds
+    // its own overload rather than the base one.
+    template<typename Set, typename T, size_t N1, typename P1, size_t N2, typename P2, typename Fn>
+    decltype(auto) dispatch2(poly_v2::unique_ptr<T, N1, P1>& a, poly_v2::unique_ptr<T, N2, P2>& b, Fn&& fn)
+    {
+        return detail::closed_dispatch<Set>::template run<T>(a, b, fn);
+    }
+
+    // Double dispatch over an open set of types. Handlers are registered at
+    // run time per ordered pair of concrete types and found through a hash
+    // of the two type tags.
+    template<typename T, typename R = void>
+    class dispatcher2
+    {
+    public:
+        using handler = ::task<R(T&, T&)>;
+
+    private:
+        using key = std::pair<const poly_v2::type_tag*, const poly_v2::type_tag*>;
+
+        std::unordered_map<key, handler, detail::tag_pair_hash> _handlers;
+        std::unordered_map<std::type_index, const poly_v2::type_tag*> _tags;   // of the registered types
+        handler _fallback;
+
+        // Objects set through a base pointer have no tag; find it from their
+        // dynamic type among the registered ones.
+        template<size_t N, typename P>
+        const poly_v2::type_tag* tag_of(const poly_v2::unique_ptr<T, N, P>& p) const
+        {
+            if (const poly_v2::type_tag* tag = p.type())
+                return tag;
+            if constexpr (std::is_polymorphic_v<T>)
+            {
+                auto it = _tags.find(std::type_index(typeid(*p.get())));
+                if (it != _tags.end())
+                    return it->second;
+            }
+            return nullptr;
+        }
+
+    public:
+        // Calls f(A&, B&) for the pair (A, B). With symmetric, also calls
+        // f(A&, B&) for the pair (B, A), swapping the arguments.
+        template<typename A, typename B, typename F>
+        void add(F f, bool symmetric = false)
+        {
+            static_assert(std::is_convertible_v<A*, T*> && std::is_convertible_v<B*, T*>, "A and B must derive from T");
+            key k{ &poly_v2::type_id<A>::tag, &poly_v2::type_id<B>::tag };
+            _tags.emplace(typeid(A), k.first);
+            _tags.emplace(typeid(B), k.second);
+            if (symmetric && k.first != k.second)
+                _handlers[{ k.second, k.first }] = [f](T& b, T& a) mutable -> R {
+                    return f(static_cast<A&>(a), static_cast<B&>(b));
+                };
+            _handlers[k] = [f = std::move(f)](T& a, T& b) mutable -> R {
+                return f(static_cast<A&>(a), static_cast<B&>(b));
+            };
+        }
+
+        // Called with the base references when no pair matches.
+        template<typename F>
+        void set_fallback(F&& f) { _fallback = handler(std::forward<F>(f)); }
+
+        bool contains(const poly_v2::type_tag* a, const poly_v2::type_tag* b) const
+        {
+            return _handlers.count({ a, b }) != 0;
+        }
+
+        // Throws std::invalid_argument if an object is empty, or if no handler
+        // or fallback matches.
+        template<size_t N1, typename P1, size_t N2, typename P2>
+        R operator()(poly_v2::unique_ptr<T, N1, P1>& a, poly_v2::unique_ptr<T, N2, P2>& b)
+        {
+            if (!a || !b)
+                throw std::invalid_argument("poly::dispatcher2: empty pointer");
+
+            auto it = _handlers.find({ tag_of(a), tag_of(b) });
+            if (it != _handlers.end())
+                return it->second(*a.get(), *b.get());
+            if (_fallback)
+                return _fallback(*a.get(), *b.get());
+            throw std::invalid_argument("poly::dispatcher2: no handler for this pair");
+        }
+    };
+
+} // namespace poly
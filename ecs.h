@@ -0,0 +1,486 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "task_system.h"
+#include "unique_ptr_v2.h"
+
+namespace poly
+{
+    // Archetype based component store for polymorphic components deriving
+    // from T. Entities with the same set of component types share an
+    // archetype, which keeps one contiguous column per type, so a query walks
+    // each matching archetype's columns linearly.
+    //
+    // A column holds poly_v2::inline_model<U, T> objects. The model's concept
+    // table is the type's identity and provides the type erased destroy and
+    // relocate operations, the same ones poly_v2::unique_ptr uses.
+    //
+    // Adding or removing a component moves the entity to another archetype
+    // by relocating each of its components once. Structural changes must not
+    // happen during a query.
+    template<typename T>
+    class world
+    {
+    public:
+        using type_key = const poly_v2::concept<T>*;
+
+        struct entity {
+            uint32_t index = ~uint32_t(0);
+            uint32_t generation = 0;
+
+            uint64_t value() const noexcept { return (uint64_t(generation) << 32) | index; }
+            explicit operator bool() const noexcept { return index != ~uint32_t(0); }
+            friend bool operator==(entity a, entity b) noexcept { return a.value() == b.value(); }
+            friend bool operator!=(entity a, entity b) noexcept { return !(a == b); }
+        };
+
+        template<typename U>
+        static type_key key() noexcept { return &poly_v2::inline_model<U, T>::vtable; }
+
+    private:
+        template<typename U>
+        using model = poly_v2::inline_model<U, T>;
+
+        struct column_info {
+            type_key type;
+            size_t align;
+
+            size_t stride() const noexcept { return type->_inline_size; }
+            friend bool operator<(const column_info& a, const column_info& b) noexcept { return a.type < b.type; }
+        };
+
+        struct column {
+            column_info info;
+            std::byte* data = nullptr;
+
+            void* at(size_t row) const noexcept { return data + row * info.stride(); }
+        };
+
+        struct archetype {
+            std::vector<column> columns;                            // sorted by type
+            std::vector<entity> entities;
+            size_t capacity = 0;
+            std::vector<std::pair<type_key, uint32_t>> add_edges;   // archetype with one more type
+            std::vector<std::pair<type_key, uint32_t>> remove_edges;
+
+            explicit archetype(const std::vector<column_info>& infos)
+            {
+                for (auto& i : infos)
+                    columns.push_back({ i });
+            }
+
+            ~archetype()
+            {
+                for (auto& c : columns)
+                {
+                    for (size_t r = 0; r < entities.size(); ++r)
+                        c.info.type->_dtor(c.at(r));
+                    ::operator delete(c.data, std::align_val_t(c.info.align));
+                }
+            }
+
+            archetype(const archetype&) = delete;
+            archetype& operator=(const archetype&) = delete;
+
+            size_t size() const noexcept { return entities.size(); }
+
+            int find(type_key t) const noexcept
+            {
+                auto it = std::lower_bound(columns.begin(), columns.end(), t,
+                    [](const column& c, type_key k) { return c.info.type < k; });
+                return it != columns.end() && it->info.type == t ? int(it - columns.begin()) : -1;
+            }
+
+            std::vector<column_info> infos() const
+            {
+                std::vector<column_info> r;
+                for (auto& c : columns)
+                    r.push_back(c.info);
+                return r;
+            }
+
+            // Appends a row whose components are not constructed yet.
+            size_t push_row(entity e)
+            {
+                if (entities.size() == capacity)
+                {
+                    size_t cap = capacity ? capacity * 2 : 16;
+                    for (auto& c : columns)
+                    {
+                        auto data = static_cast<std::byte*>(::operator new(cap * c.info.stride(), std::align_val_t(c.info.align)));
+                        type_key k;
+                        for (size_t r = 0; r < entities.size(); ++r)
+                            c.info.type->_relocate(k, c.at(r), data + r * c.info.stride());
+                        ::operator delete(c.data, std::align_val_t(c.info.align));
+                        c.data = data;
+                    }
+                    capacity = cap;
+                }
+                entities.push_back(e);
+                return entities.size() - 1;
+            }
+
+            // Removes a row whose components were destroyed or relocated away
+            // by moving the last row into it. Returns the entity that moved.
+            entity pop_row(size_t row) noexcept
+            {
+                size_t last = entities.size() - 1;
+                entity moved;
+                if (row != last)
+                {
+                    type_key k;
+                    for (auto& c : columns)
+                        c.info.type->_relocate(k, c.at(last), c.at(row));
+                    moved = entities[row] = entities[last];
+                }
+                entities.pop_back();
+                return moved;
+            }
+        };
+
+        struct record {
+            uint32_t archetype = 0;
+            uint32_t row = 0;
+            uint32_t generation = 0;
+        };
+
+        std::vector<std::unique_ptr<archetype>> _archetypes;
+        std::map<std::vector<type_key>, uint32_t> _index;
+        std::vector<record> _records;
+        std::vector<uint32_t> _free;
+        size_t _count = 0;
+
+        uint32_t find_or_create(std::vector<column_info> infos)
+        {
+            std::sort(infos.begin(), infos.end());
+            std::vector<type_key> types;
+            for (auto& i : infos)
+                types.push_back(i.type);
+
+            auto it = _index.find(types);
+            if (it != _index.end())
+                return it->second;
+
+            auto id = uint32_t(_archetypes.size());
+            _archetypes.push_back(std::make_unique<archetype>(infos));
+            _index.emplace(std::move(types), id);
+            return id;
+        }
+
+        template<typename U>
+        static column_info info_of() noexcept { return { key<U>(), alignof(model<U>) }; }
+
+        uint32_t add_edge(uint32_t from, const column_info& info)
+        {
+            for (auto& e : _archetypes[from]->add_edges)
+                if (e.first == info.type)
+                    return e.second;
+
+            auto infos = _archetypes[from]->infos();
+            infos.push_back(info);
+            auto to = find_or_create(std::move(infos));
+            _archetypes[from]->add_edges.emplace_back(info.type, to);
+            return to;
+        }
+
+        uint32_t remove_edge(uint32_t from, type_key type)
+        {
+            for (auto& e : _archetypes[from]->remove_edges)
+                if (e.first == type)
+                    return e.second;
+
+            auto infos = _archetypes[from]->infos();
+            infos.erase(std::find_if(infos.begin(), infos.end(), [&](auto& i) { return i.type == type; }));
+            auto to = find_or_create(std::move(infos));
+            _archetypes[from]->remove_edges.emplace_back(type, to);
+            return to;
+        }
+
+        bool valid(entity e) const noexcept
+        {
+            return e.index < _records.size() && _records[e.index].generation == e.generation;
+        }
+
+        void relink(entity moved, uint32_t row) noexcept
+        {
+            if (moved)
+                _records[moved.index].row = row;
+        }
+
+        // Relocates the components of e present in dst into its new row and
+        // removes the old row.
+        void migrate(entity e, uint32_t to, size_t new_row) noexcept
+        {
+            auto& rec = _records[e.index];
+            auto& src = *_archetypes[rec.archetype];
+            auto& dst = *_archetypes[to];
+            type_key k;
+            for (auto& c : src.columns)
+            {
+                int j = dst.find(c.info.type);
+                if (j >= 0)
+                    c.info.type->_relocate(k, c.at(rec.row), dst.columns[j].at(new_row));
+            }
+            relink(src.pop_row(rec.row), rec.row);
+            rec.archetype = to;
+            rec.row = uint32_t(new_row);
+        }
+
+        entity allocate(uint32_t arch, uint32_t row)
+        {
+            uint32_t i;
+            if (_free.empty())
+            {
+                i = uint32_t(_records.size());
+                _records.emplace_back();
+            }
+            else
+            {
+                i = _free.back();
+                _free.pop_back();
+            }
+            _records[i].archetype = arch;
+            _records[i].row = row;
+            ++_count;
+            return { i, _records[i].generation };
+        }
+
+        entity next_entity() const noexcept
+        {
+            uint32_t i = _free.empty() ? uint32_t(_records.size()) : _free.back();
+            return { i, i < _records.size() ? _records[i].generation : 0 };
+        }
+
+        template<size_t n>
+        struct match {
+            archetype* a;
+            std::array<column*, n> columns;
+        };
+
+        template<typename... Us>
+        std::vector<match<sizeof...(Us)>> matching()
+        {
+            std::vector<match<sizeof...(Us)>> r;
+            for (auto& a : _archetypes)
+            {
+                if (!a->size())
+                    continue;
+                std::array<int, sizeof...(Us)> idx{ a->find(key<Us>())... };
+                if (std::find(idx.begin(), idx.end(), -1) != idx.end())
+                    continue;
+                match<sizeof...(Us)> m{ a.get(), {} };
+                for (size_t i = 0; i < idx.size(); ++i)
+                    m.columns[i] = &a->columns[idx[i]];
+                r.push_back(m);
+            }
+            return r;
+        }
+
+        template<typename... Us, typename M, typename F, size_t... I>
+        static void run_rows(const M& m, size_t begin, size_t end, F& f, std::index_sequence<I...>)
+        {
+            auto base = std::make_tuple(reinterpret_cast<model<Us>*>(m.columns[I]->data)...);
+            for (size_t r = begin; r < end; ++r)
+                f(m.a->entities[r], std::get<I>(base)[r]._u...);
+        }
+
+    public:
+        world() { find_or_create({}); }
+
+        world(const world&) = delete;
+        world& operator=(const world&) = delete;
+
+        // Creates an entity with the given components.
+        template<typename... Us>
+        entity create(Us&&... components)
+        {
+            auto arch = find_or_create({ info_of<std::decay_t<Us>>()... });
+            auto& a = *_archetypes[arch];
+            size_t row = a.push_row(next_entity());
+
+            // Constructs each component, destroying the ones already built on failure.
+            type_key k;
+            size_t built = 0;
+            try
+            {
+                ((new (a.columns[a.find(key<std::decay_t<Us>>())].at(row))
+                    model<std::decay_t<Us>>(k, std::forward<Us>(components)), ++built), ...);
+            }
+            catch (...)
+            {
+                std::array<type_key, sizeof...(Us)> keys{ key<std::decay_t<Us>>()... };
+                for (size_t i = 0; i < built; ++i)
+                    keys[i]->_dtor(a.columns[a.find(keys[i])].at(row));
+                a.entities.pop_back();
+                throw;
+            }
+            return allocate(arch, uint32_t(row));
+        }
+
+        // Destroys e and all its components. Returns false if e is stale.
+        bool destroy(entity e)
+        {
+            if (!valid(e))
+                return false;
+
+            auto& rec = _records[e.index];
+            auto& a = *_archetypes[rec.archetype];
+            for (auto& c : a.columns)
+                c.info.type->_dtor(c.at(rec.row));
+            relink(a.pop_row(rec.row), rec.row);
+
+            ++rec.generation;
+            _free.push_back(e.index);
+            --_count;
+            return true;
+        }
+
+        bool alive(entity e) const noexcept { return valid(e); }
+
+        // Constructs a U component on e, replacing any existing one.
+        template<typename U, typename... Args>
+        U& add(entity e, Args&&... args)
+        {
+            if (!valid(e))
+                throw std::out_of_range("poly::world::add on a destroyed entity");
+
+            auto& rec = _records[e.index];
+            if (int j = _archetypes[rec.archetype]->find(key<U>()); j >= 0)
+            {
+                auto p = static_cast<model<U>*>(_archetypes[rec.archetype]->columns[j].at(rec.row));
+                p->_u = U(std::forward<Args>(args)...);
+                return p->_u;
+            }
+
+            auto to = add_edge(rec.archetype, info_of<U>());
+            auto& dst = *_archetypes[to];
+            size_t row = dst.push_row(e);
+            type_key k;
+            model<U>* p;
+            try
+            {
+                p = new (dst.columns[dst.find(key<U>())].at(row)) model<U>(k, std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                dst.entities.pop_back();
+                throw;
+            }
+            migrate(e, to, row);
+            return p->_u;
+        }
+
+        // Destroys e's U component. Returns false if it has none.
+        template<typename U>
+        bool remove(entity e)
+        {
+            if (!valid(e))
+                return false;
+
+            auto& rec = _records[e.index];
+            auto& src = *_archetypes[rec.archetype];
+            int j = src.find(key<U>());
+            if (j < 0)
+                return false;
+
+            // Make room in the destination first; if that throws, e keeps U.
+            auto to = remove_edge(rec.archetype, key<U>());
+            size_t row = _archetypes[to]->push_row(e);
+            src.columns[j].info.type->_dtor(src.columns[j].at(rec.row));
+            migrate(e, to, row);
+            return true;
+        }
+
+        template<typename U>
+        U* get(entity e) noexcept
+        {
+            if (!valid(e))
+                return nullptr;
+            auto& rec = _records[e.index];
+            auto& a = *_archetypes[rec.archetype];
+            int j = a.find(key<U>());
+            return j < 0 ? nullptr : &static_cast<model<U>*>(a.columns[j].at(rec.row))->_u;
+        }
+
+        template<typename U>
+        bool has(entity e) const noexcept
+        {
+            return valid(e) && _archetypes[_records[e.index].archetype]->find(key<U>()) >= 0;
+        }
+
+        // Calls f(t) with each component of e as a T&.
+        template<typename F>
+        void for_each_component(entity e, F&& f)
+        {
+            if (!valid(e))
+                return;
+            auto& rec = _records[e.index];
+            for (auto& c : _archetypes[rec.archetype]->columns)
+                f(*c.info.type->_get(c.at(rec.row)));
+        }
+
+        // Calls f(entity, Us&...) for every entity that has all of Us.
+        template<typename... Us, typename F>
+        void query(F&& f)
+        {
+            for (auto& m : matching<Us...>())
+                run_rows<Us...>(m, 0, m.a->size(), f, std::index_sequence_for<Us...>{});
+        }
+
+        // Like query, but splits the matching rows into chunks of up to chunk
+        // rows run on executor, and returns once they are all done. f is
+        // called concurrently from several threads. The calling thread runs
+        // one chunk and then blocks, so do not call this from a task running
+        // on executor.
+        template<typename... Us, typename F>
+        void parallel_query(task_system& executor, F&& f, size_t chunk = 4096)
+        {
+            struct job {
+                match<sizeof...(Us)> m;
+                size_t begin, end;
+            };
+            std::vector<job> jobs;
+            for (auto& m : matching<Us...>())
+                for (size_t b = 0; b < m.a->size(); b += chunk)
+                    jobs.push_back({ m, b, std::min(b + chunk, m.a->size()) });
+            if (jobs.empty())
+                return;
+
+            std::atomic<size_t> left{ jobs.size() - 1 };
+            std::mutex mutex;
+            std::condition_variable done;
+            for (size_t i = 1; i < jobs.size(); ++i)
+            {
+                executor.async_([&, i] {
+                    run_rows<Us...>(jobs[i].m, jobs[i].begin, jobs[i].end, f, std::index_sequence_for<Us...>{});
+                    if (left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        done.notify_one();
+                    }
+                });
+            }
+
+            run_rows<Us...>(jobs[0].m, jobs[0].begin, jobs[0].end, f, std::index_sequence_for<Us...>{});
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [&] { return left.load(std::memory_order_acquire) == 0; });
+        }
+
+        size_t size() const noexcept { return _count; }
+        size_t archetype_count() const noexcept { return _archetypes.size(); }
+    };
+
+} // namespace poly
@@ -0,0 +1,439 @@
+#pragma once
+
+// Asynchronous file I/O over io_uring, with a thread pool fallback. Linux
+// only; the header is empty elsewhere.
+#if defined(__linux__)
+
+#include <condition_variable>
+#include <cstdint>
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "task.h"
+#include "task_system.h"
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define POLY_IO_URING 1
+#endif
+
+namespace poly
+{
+    // Reads and writes at explicit offsets whose continuations are
+    // task<void(int result)> objects stored inline in a preallocated request
+    // slot, so issuing an I/O does not allocate. result is the byte count or
+    // -errno.
+    //
+    // Requests are queued by read()/write() and handed to the kernel in one
+    // batch by submit(). Continuations run on the thread calling poll() or
+    // wait(). When every slot is in use, read()/write() submit and wait for a
+    // completion, which may run other continuations first.
+    //
+    // When io_uring is unavailable (older kernels, seccomp) the same interface
+    // runs pread/pwrite on a task_system.
+    class file_io
+    {
+    public:
+        using completion = ::task<void(int)>;
+
+    private:
+        enum class op : uint8_t { read, write, read_fixed, write_fixed };
+
+        struct request {
+            op code;
+            int fd;
+            void* buf;
+            unsigned len;
+            uint64_t offset;
+            unsigned buf_index;
+            uint32_t slot;
+        };
+
+        using result_list = std::vector<std::pair<uint32_t, int>>;
+
+        std::vector<completion> _slots;
+        std::vector<uint32_t> _free;
+        std::vector<request> _queued;
+        size_t _in_flight = 0;
+        result_list _spare;         // reused by the outermost poll()
+
+        // Fallback backend. The workers read their request from its slot in
+        // _submitted, so the task captures two words and stays inline.
+        std::unique_ptr<task_system> _pool;
+        std::vector<request> _submitted;
+        std::mutex _done_mutex;
+        std::condition_variable _done_ready;
+        result_list _done;
+
+#ifdef POLY_IO_URING
+        int _ring = -1;
+        void* _sq_map = nullptr;
+        size_t _sq_map_size = 0;
+        void* _cq_map = nullptr;
+        size_t _cq_map_size = 0;
+        io_uring_sqe* _sqes = nullptr;
+        size_t _sqes_size = 0;
+
+        unsigned* _sq_head = nullptr;
+        unsigned* _sq_tail = nullptr;
+        unsigned* _sq_array = nullptr;
+        unsigned _sq_mask = 0;
+        unsigned _sq_entries = 0;
+        unsigned* _cq_head = nullptr;
+        unsigned* _cq_tail = nullptr;
+        io_uring_cqe* _cqes = nullptr;
+        unsigned _cq_mask = 0;
+
+        bool setup_ring(unsigned entries)
+        {
+            io_uring_params p{};
+            _ring = int(syscall(__NR_io_uring_setup, entries, &p));
+            if (_ring < 0)
+                return false;
+
+            _sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            _cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+            if (single && _cq_map_size > _sq_map_size)
+                _sq_map_size = _cq_map_size;
+
+            _sq_map = mmap(nullptr, _sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+            if (_sq_map == MAP_FAILED)
+                return teardown_ring(), false;
+            if (single)
+                _cq_map = _sq_map;
+            else
+            {
+                _cq_map = mmap(nullptr, _cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+                if (_cq_map == MAP_FAILED)
+                    return _cq_map = nullptr, teardown_ring(), false;
+            }
+            _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+            auto sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED)
+                return teardown_ring(), false;
+            _sqes = static_cast<io_uring_sqe*>(sqes);
+
+            auto sq = static_cast<char*>(_sq_map);
+            _sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+            _sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+            _sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+            _sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+            _sq_entries = p.sq_entries;
+
+            auto cq = static_cast<char*>(_cq_map);
+            _cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+            _cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+            _cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+            _cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+            return true;
+        }
+
+        void teardown_ring()
+        {
+            if (_sqes)
+                munmap(_sqes, _sqes_size);
+            if (_cq_map && _cq_map != _sq_map)
+                munmap(_cq_map, _cq_map_size);
+            if (_sq_map && _sq_map != MAP_FAILED)
+                munmap(_sq_map, _sq_map_size);
+            if (_ring >= 0)
+                ::close(_ring);
+            _ring = -1;
+            _sqes = nullptr;
+            _sq_map = _cq_map = nullptr;
+        }
+
+        int enter(unsigned to_submit, unsigned min_complete)
+        {
+            unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+            int r;
+            do
+                r = int(syscall(__NR_io_uring_enter, _ring, to_submit, min_complete, flags, nullptr, 0));
+            while (r < 0 && errno == EINTR);
+            return r;
+        }
+
+        // Copies the queued requests into SQEs and submits them.
+        unsigned submit_ring(unsigned min_complete)
+        {
+            unsigned tail = *_sq_tail;
+            unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+            unsigned count = 0;
+            for (auto& r : _queued)
+            {
+                if (tail - head == _sq_entries)
+                    break;
+                unsigned index = tail & _sq_mask;
+                io_uring_sqe& sqe = _sqes[index];
+                sqe = io_uring_sqe{};
+                switch (r.code)
+                {
+                case op::read: sqe.opcode = IORING_OP_READ; break;
+                case op::write: sqe.opcode = IORING_OP_WRITE; break;
+                case op::read_fixed: sqe.opcode = IORING_OP_READ_FIXED; sqe.buf_index = uint16_t(r.buf_index); break;
+                case op::write_fixed: sqe.opcode = IORING_OP_WRITE_FIXED; sqe.buf_index = uint16_t(r.buf_index); break;
+                }
+                sqe.fd = r.fd;
+                sqe.addr = reinterpret_cast<uintptr_t>(r.buf);
+                sqe.len = r.len;
+                sqe.off = r.offset;
+                sqe.user_data = r.slot;
+                _sq_array[index] = index;
+                ++tail;
+                ++count;
+            }
+            __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+            _queued.erase(_queued.begin(), _queued.begin() + count);
+
+            if (count || min_complete)
+                if (enter(count, min_complete) < 0)
+                    throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            return count;
+        }
+
+        size_t reap_ring()
+        {
+            unsigned head = *_cq_head;
+            unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+            result_list reaped = take_spare();
+            for (; head != tail; ++head)
+            {
+                auto& cqe = _cqes[head & _cq_mask];
+                reaped.emplace_back(uint32_t(cqe.user_data), cqe.res);
+            }
+            __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+            return complete(reaped);
+        }
+#endif
+
+        bool uring() const noexcept
+        {
+#ifdef POLY_IO_URING
+            return _ring >= 0;
+#else
+            return false;
+#endif
+        }
+
+        // The list results are reaped into. A continuation that calls poll()
+        // finds _spare taken and reaps into a list of its own, so it never
+        // touches the list its caller is iterating.
+        result_list take_spare() noexcept
+        {
+            result_list list;
+            list.swap(_spare);
+            list.clear();
+            return list;
+        }
+
+        // Runs the continuations of the reaped requests and frees their slots.
+        size_t complete(result_list& reaped)
+        {
+            for (auto& [slot, result] : reaped)
+            {
+                completion fn = std::move(_slots[slot]);
+                _free.push_back(slot);
+                --_in_flight;
+                fn(result);
+            }
+            size_t count = reaped.size();
+            if (reaped.capacity() > _spare.capacity())
+                _spare.swap(reaped);
+            return count;
+        }
+
+        unsigned submit_pool()
+        {
+            for (auto& q : _queued)
+            {
+                _submitted[q.slot] = q;
+                _pool->async_([this, slot = q.slot] {
+                    const request& r = _submitted[slot];
+                    ssize_t n;
+                    if (r.code == op::read || r.code == op::read_fixed)
+                        n = ::pread(r.fd, r.buf, r.len, off_t(r.offset));
+                    else
+                        n = ::pwrite(r.fd, r.buf, r.len, off_t(r.offset));
+                    {
+                        std::lock_guard<std::mutex> lock(_done_mutex);
+                        _done.emplace_back(slot, n < 0 ? -errno : int(n));
+                    }
+                    _done_ready.notify_one();
+                });
+            }
+            auto count = unsigned(_queued.size());
+            _queued.clear();
+            return count;
+        }
+
+        size_t reap_pool(unsigned min_complete)
+        {
+            result_list reaped = take_spare();
+            {
+                std::unique_lock<std::mutex> lock(_done_mutex);
+                if (min_complete)
+                    _done_ready.wait(lock, [&] { return _done.size() >= min_complete; });
+                reaped.swap(_done);
+            }
+            return complete(reaped);
+        }
+
+        template <class F>
+        void queue(op code, int fd, void* buf, unsigned len, uint64_t offset, unsigned buf_index, F&& done)
+        {
+            while (_free.empty())
+            {
+                submit();
+                wait(1);
+            }
+            uint32_t slot = _free.back();
+            _free.pop_back();
+            _slots[slot] = completion(std::forward<F>(done));
+            _queued.push_back({ code, fd, buf, len, offset, buf_index, slot });
+            ++_in_flight;
+        }
+
+    public:
+        // Allocates entries request slots. With use_io_uring false, or when
+        // io_uring cannot be set up, uses a pool of fallback_threads threads.
+        explicit file_io(unsigned entries = 256, bool use_io_uring = true, unsigned fallback_threads = 4)
+            : _slots(entries)
+        {
+            _free.reserve(entries);
+            for (unsigned i = entries; i-- > 0;)
+                _free.push_back(i);
+            _queued.reserve(entries);
+            _spare.reserve(entries);
+
+#ifdef POLY_IO_URING
+            if (use_io_uring && setup_ring(entries))
+                return;
+#else
+            (void)use_io_uring;
+#endif
+            _done.reserve(entries);
+            _submitted.resize(entries);
+            _pool = std::make_unique<task_system>(fallback_threads);
+        }
+
+        // Waits for the requests in flight.
+        ~file_io()
+        {
+            submit();
+            while (_in_flight)
+                wait(1);
+            _pool.reset();      // joins the workers before _done_ready goes away
+#ifdef POLY_IO_URING
+            teardown_ring();
+#endif
+        }
+
+        file_io(const file_io&) = delete;
+        file_io& operator=(const file_io&) = delete;
+
+        bool uses_io_uring() const noexcept { return uring(); }
+        size_t in_flight() const noexcept { return _in_flight; }
+
+        // Registers buffers with the kernel for read_fixed/write_fixed, which
+        // then skip mapping the pages on every request. Must be called with no
+        // requests in flight.
+        void register_buffers(const iovec* buffers, unsigned count)
+        {
+#ifdef POLY_IO_URING
+            if (uring() && syscall(__NR_io_uring_register, _ring, IORING_REGISTER_BUFFERS, buffers, count) < 0)
+                throw std::system_error(errno, std::generic_category(), "io_uring_register");
+#else
+            (void)buffers, (void)count;
+#endif
+        }
+
+        template <class F>
+        void read(int fd, void* buf, unsigned len, uint64_t offset, F&& done)
+        {
+            queue(op::read, fd, buf, len, offset, 0, std::forward<F>(done));
+        }
+
+        template <class F>
+        void write(int fd, const void* buf, unsigned len, uint64_t offset, F&& done)
+        {
+            queue(op::write, fd, const_cast<void*>(buf), len, offset, 0, std::forward<F>(done));
+        }
+
+        // buf must lie within registered buffer buf_index.
+        template <class F>
+        void read_fixed(int fd, unsigned buf_index, void* buf, unsigned len, uint64_t offset, F&& done)
+        {
+            queue(op::read_fixed, fd, buf, len, offset, buf_index, std::forward<F>(done));
+        }
+
+        template <class F>
+        void write_fixed(int fd, unsigned buf_index, const void* buf, unsigned len, uint64_t offset, F&& done)
+        {
+            queue(op::write_fixed, fd, const_cast<void*>(buf), len, offset, buf_index, std::forward<F>(done));
+        }
+
+        // Hands every queued request to the backend. Returns the number submitted.
+        unsigned submit()
+        {
+            unsigned count = 0;
+#ifdef POLY_IO_URING
+            if (uring())
+            {
+                while (!_queued.empty())
+                {
+                    auto n = submit_ring(0);
+                    count += n;
+                    if (!n)
+                        reap_ring();    // submission queue full
+                }
+                return count;
+            }
+#endif
+            count = submit_pool();
+            return count;
+        }
+
+        // Runs the continuations of the completed requests without blocking.
+        size_t poll()
+        {
+#ifdef POLY_IO_URING
+            if (uring())
+                return reap_ring();
+#endif
+            return reap_pool(0);
+        }
+
+        // Submits the queued requests, waits for at least min_complete
+        // completions (bounded by the requests in flight) and runs them.
+        size_t wait(unsigned min_complete = 1)
+        {
+            submit();
+            if (min_complete > _in_flight)
+                min_complete = unsigned(_in_flight);
+#ifdef POLY_IO_URING
+            if (uring())
+            {
+                size_t count = reap_ring();
+                if (count < min_complete)
+                {
+                    submit_ring(unsigned(min_complete - count));
+                    count += reap_ring();
+                }
+                return count;
+            }
+#endif
+            return reap_pool(min_complete);
+        }
+    };
+
+} // namespace poly
+
+#endif
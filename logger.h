@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "spsc_ring.h"
+#include "task.h"
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace poly
+{
+    namespace detail
+    {
+        inline void append_arg(std::string& out, std::string_view s) { out.append(s.data(), s.size()); }
+        inline void append_arg(std::string& out, const char* s) { out.append(s ? s : "(null)"); }
+        inline void append_arg(std::string& out, const std::string& s) { out.append(s); }
+        inline void append_arg(std::string& out, char c) { out.push_back(c); }
+        inline void append_arg(std::string& out, bool b) { out.append(b ? "true" : "false"); }
+
+        template<typename A>
+        void append_arg(std::string& out, const A& a)
+        {
+            if constexpr (std::is_arithmetic_v<A>)
+            {
+                char buf[64];
+                auto r = std::to_chars(buf, buf + sizeof(buf), a);
+                out.append(buf, r.ptr);
+            }
+            else if constexpr (std::is_pointer_v<A>)
+            {
+                char buf[2 + 2 * sizeof(void*)] = { '0', 'x' };
+                auto r = std::to_chars(buf + 2, buf + sizeof(buf), reinterpret_cast<uintptr_t>(a), 16);
+                out.append(buf, r.ptr);
+            }
+            else
+            {
+                std::ostringstream ss;
+                ss << a;
+                out.append(ss.str());
+            }
+        }
+
+        // The type log() stores for an argument of type A. Strings that are
+        // only referenced (char pointers and arrays, string_view) are copied so
+        // the record does not outlive them.
+        template<typename A, typename D = std::decay_t<A>>
+        using captured_t = std::conditional_t<
+            std::is_same_v<D, char*> || std::is_same_v<D, const char*> || std::is_same_v<D, std::string_view>,
+            std::string, D>;
+
+        template<typename A>
+        captured_t<A> capture(A&& a)
+        {
+            using D = std::decay_t<A>;
+            if constexpr (std::is_array_v<std::remove_reference_t<A>>)
+                return std::string(a);
+            else if constexpr (std::is_same_v<D, char*> || std::is_same_v<D, const char*>)
+                return a ? std::string(a) : std::string("(null)");
+            else
+                return captured_t<A>(std::forward<A>(a));
+        }
+
+        // Replaces each "{}" in fmt with the next argument.
+        template<typename Tuple, size_t... I>
+        void format_to(std::string& out, const char* fmt, const Tuple& args, std::index_sequence<I...>)
+        {
+            auto next = [&] {
+                const char* p = fmt;
+                while (*p && !(p[0] == '{' && p[1] == '}')) ++p;
+                out.append(fmt, p);
+                fmt = *p ? p + 2 : p;
+            };
+            (void)next;
+            ((next(), append_arg(out, std::get<I>(args))), ...);
+            out.append(fmt);
+            out.push_back('\n');
+        }
+    }
+
+    // What log() does when the calling thread's ring is full.
+    enum class overflow_policy {
+        block,  // wait for the background thread to make room
+        drop,   // discard the record and count it in dropped()
+        spill,  // append to a locked overflow queue; may reorder records around the overflow
+    };
+
+    // Asynchronous logger. log() captures the format string and arguments into
+    // an inline task, pushes it onto a ring owned by the calling thread and
+    // returns. A background thread formats the records and writes them to fd
+    // in large batches.
+    //
+    // The format string is captured by pointer and must outlive the call
+    // (string literals do). String arguments (char pointers and arrays,
+    // std::string_view) are copied into a std::string; everything else is
+    // captured by value. A record must fit the inline buffer of record, so a
+    // call whose captures do not fit fails to compile.
+    //
+    // Records logged by one thread are written in order. Records from
+    // different threads are not globally ordered: each pass takes a batch
+    // from every ring in turn, so a record may be written before one that
+    // another thread logged earlier. Overflow records (overflow_policy::spill)
+    // are written after the rings of the same pass.
+    //
+    // A thread's ring for a logger lives until the thread exits and the
+    // background thread has drained it, or until the logger is destroyed.
+    class logger
+    {
+    public:
+        using record = ::task<void(std::string&), 96>;
+        static constexpr size_t ring_capacity = 4096;
+        static constexpr size_t write_batch = 64 * 1024;
+
+    private:
+        using ring = spsc_ring<record, ring_capacity>;
+
+        // One thread's ring for one logger. retired is set when the thread
+        // exits, orphaned when the logger is destroyed.
+        struct producer {
+            ring r;
+            std::atomic<bool> retired{ false };
+            std::atomic<bool> orphaned{ false };
+        };
+
+        // The rings of the calling thread, one per logger it has logged to.
+        struct thread_rings {
+            std::vector<std::pair<uint64_t, std::shared_ptr<producer>>> entries;
+
+            ~thread_rings()
+            {
+                for (auto& e : entries)
+                    e.second->retired.store(true, std::memory_order_release);
+            }
+        };
+
+        const int _fd;
+        const overflow_policy _policy;
+        const uint64_t _id = next_id();
+        std::atomic<bool> _stop{ false };
+        std::atomic<size_t> _dropped{ 0 };
+
+        std::mutex _rings_mutex;
+        std::vector<std::shared_ptr<producer>> _rings;
+        std::atomic<size_t> _rings_version{ 0 };
+
+        std::mutex _overflow_mutex;
+        std::deque<record> _overflow;
+        std::atomic<bool> _has_overflow{ false };
+
+        std::thread _thread;
+
+        static uint64_t next_id()
+        {
+            static std::atomic<uint64_t> id{ 0 };
+            return ++id;
+        }
+
+        ring& local_ring()
+        {
+            thread_local thread_rings t;
+            auto& entries = t.entries;
+            for (auto& e : entries)
+                if (e.first == _id)
+                    return e.second->r;
+
+            // First record for this logger; forget the rings of destroyed loggers.
+            entries.erase(std::remove_if(entries.begin(), entries.end(),
+                [](auto& e) { return e.second->orphaned.load(std::memory_order_acquire); }), entries.end());
+
+            auto p = std::make_shared<producer>();
+            entries.emplace_back(_id, p);
+            std::lock_guard<std::mutex> lock(_rings_mutex);
+            _rings.push_back(std::move(p));
+            _rings_version.fetch_add(1, std::memory_order_release);
+            return entries.back().second->r;
+        }
+
+        static bool finished(const std::shared_ptr<producer>& p)
+        {
+            return p->retired.load(std::memory_order_acquire) && p->r.empty();
+        }
+
+        // Drops the rings of exited threads once everything in them is written.
+        void remove_finished(const std::vector<std::shared_ptr<producer>>& rings)
+        {
+            if (std::none_of(rings.begin(), rings.end(), finished))
+                return;
+            std::lock_guard<std::mutex> lock(_rings_mutex);
+            _rings.erase(std::remove_if(_rings.begin(), _rings.end(), finished), _rings.end());
+            _rings_version.fetch_add(1, std::memory_order_release);
+        }
+
+        void write_all(std::string& buf)
+        {
+            size_t done = 0;
+            while (done < buf.size())
+            {
+#if defined(_WIN32)
+                auto n = _write(_fd, buf.data() + done, static_cast<unsigned>(buf.size() - done));
+#else
+                auto n = ::write(_fd, buf.data() + done, buf.size() - done);
+#endif
+                if (n <= 0)
+                    break;
+                done += static_cast<size_t>(n);
+            }
+            buf.clear();
+        }
+
+        // Formats everything currently queued. Returns the number of records.
+        size_t drain(std::vector<std::shared_ptr<producer>>& rings, std::string& buf)
+        {
+            size_t count = 0;
+            auto format = [&](record&& r) {
+                r(buf);
+                if (buf.size() >= write_batch)
+                    write_all(buf);
+            };
+
+            for (auto& r : rings)
+                count += r->r.consume(format);
+
+            if (_has_overflow.load(std::memory_order_acquire))
+            {
+                std::deque<record> overflow;
+                {
+                    std::lock_guard<std::mutex> lock(_overflow_mutex);
+                    overflow.swap(_overflow);
+                    _has_overflow.store(false, std::memory_order_relaxed);
+                }
+                for (auto& r : overflow)
+                    format(std::move(r));
+                count += overflow.size();
+            }
+            return count;
+        }
+
+        void run()
+        {
+            std::vector<std::shared_ptr<producer>> rings;
+            size_t version = 0;
+            std::string buf;
+            buf.reserve(write_batch * 2);
+            unsigned idle = 0;
+
+            while (true)
+            {
+                bool stopping = _stop.load(std::memory_order_acquire);
+
+                if (version != _rings_version.load(std::memory_order_acquire))
+                {
+                    std::lock_guard<std::mutex> lock(_rings_mutex);
+                    rings = _rings;
+                    version = _rings_version.load(std::memory_order_relaxed);
+                }
+
+                if (drain(rings, buf))
+                {
+                    idle = 0;
+                    continue;
+                }
+
+                write_all(buf);
+                if (stopping)
+                    break;
+
+                remove_finished(rings);
+
+                if (++idle < 64)
+                    std::this_thread::yield();
+                else
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+
+    public:
+        explicit logger(int fd = 1, overflow_policy policy = overflow_policy::block)
+            : _fd(fd)
+            , _policy(policy)
+            , _thread([this] { run(); })
+        {}
+
+        // Writes every record logged before the call and stops the background thread.
+        ~logger()
+        {
+            _stop.store(true, std::memory_order_release);
+            _thread.join();
+
+            std::lock_guard<std::mutex> lock(_rings_mutex);
+            for (auto& p : _rings)
+                p->orphaned.store(true, std::memory_order_release);
+        }
+
+        logger(const logger&) = delete;
+        logger& operator=(const logger&) = delete;
+
+        template<typename... A>
+        void log(const char* fmt, A&&... args)
+        {
+            auto& r = local_ring();
+            auto fn = [fmt, captured = std::make_tuple(detail::capture(std::forward<A>(args))...)](std::string& out) {
+                detail::format_to(out, fmt, captured, std::index_sequence_for<A...>{});
+            };
+
+            if (r.try_push(inline_only, std::move(fn)))
+                return;
+
+            switch (_policy)
+            {
+            case overflow_policy::block:
+                while (!r.try_push(inline_only, std::move(fn)))
+                    std::this_thread::yield();
+                break;
+            case overflow_policy::drop:
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                break;
+            case overflow_policy::spill:
+            {
+                std::lock_guard<std::mutex> lock(_overflow_mutex);
+                _overflow.emplace_back(inline_only, std::move(fn));
+                _has_overflow.store(true, std::memory_order_release);
+                break;
+            }
+            }
+        }
+
+        // Number of records discarded by overflow_policy::drop.
+        size_t dropped() const noexcept { return _dropped.load(std::memory_order_relaxed); }
+    };
+
+} // namespace poly
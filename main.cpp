@@ -46,6 +46,9 @@ struct special_small : public small
     std::string to_string() override { return "special small: " + std::to_string(val); }
 };
 
+// Lets release<small>() find special_small's base without RTTI.
+template<> struct poly_v2::bases<special_small> { using type = std::tuple<small>; };
+
 template<typename Ptr>
 void print(Ptr& ptr)
 {
@@ -94,6 +97,12 @@ int main()
     tinyPtr = std::move(largePtr);
     print(tinyPtr);
 
+    // The stored type is exactly special_small, so release<small>() finds
+    // the base through bases<special_small>.
+    largePtr.emplace<special_small>(11, 'd');
+    delete largePtr.release<small>();
+
+    // Only known as a small*, so this one is kept on the heap and found with RTTI.
     small* ss = new special_small(10, 'c');
 
 
@@ -0,0 +1,290 @@
+#pragma once
+
+// epoll based reactor. Linux only; the header is empty elsewhere.
+#if defined(__linux__)
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "task.h"
+#include "task_system.h"
+
+namespace poly
+{
+    // Single threaded readiness loop. The handler of each fd is a
+    // task<void(uint32_t events)> stored inline in a slot array indexed by the
+    // fd, so registering and dispatching do not allocate for small callables.
+    //
+    // Everything but post() and stop() must be called from the thread running
+    // the loop. Handlers may add, modify and remove fds, including their own.
+    class reactor
+    {
+    public:
+        using handler = ::task<void(uint32_t)>;
+
+    private:
+        struct slot {
+            handler fn;
+            uint32_t generation = 0;
+            bool active = false;
+            bool owned = false;     // a timerfd created by add_timer, closed on removal
+        };
+
+        static constexpr uint64_t wake_key = ~uint64_t(0);
+        static constexpr int max_events = 64;
+
+        int _epoll = -1;
+        int _wake = -1;
+        std::vector<slot> _slots;
+        std::atomic<bool> _stop{ false };
+
+        std::mutex _posted_mutex;
+        std::vector<::task<void()>> _posted;
+        std::vector<::task<void()>> _running;
+
+        [[noreturn]] static void fail(const char* what)
+        {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+        static uint64_t key(int fd, uint32_t generation) noexcept
+        {
+            return (uint64_t(generation) << 32) | uint32_t(fd);
+        }
+
+        void control(int op, int fd, uint32_t events)
+        {
+            epoll_event ev{};
+            ev.events = events;
+            ev.data.u64 = key(fd, _slots[fd].generation);
+            if (epoll_ctl(_epoll, op, fd, &ev) != 0)
+                fail("epoll_ctl");
+        }
+
+        size_t run_posted()
+        {
+            uint64_t n;
+            while (::read(_wake, &n, sizeof(n)) > 0) {}
+
+            {
+                std::lock_guard<std::mutex> lock(_posted_mutex);
+                _running.swap(_posted);
+            }
+            for (auto& f : _running)
+                f();
+            auto count = _running.size();
+            _running.clear();
+            return count;
+        }
+
+        void dispatch(uint64_t k, uint32_t events)
+        {
+            int fd = int(uint32_t(k));
+            auto generation = uint32_t(k >> 32);
+            if (size_t(fd) >= _slots.size() || !_slots[fd].active || _slots[fd].generation != generation)
+                return;     // removed earlier in this batch
+
+            // The handler runs out of its slot so that it may remove or
+            // replace itself, and so that adds may grow _slots.
+            handler fn = std::move(_slots[fd].fn);
+            fn(events);
+            if (_slots[fd].generation == generation)
+                _slots[fd].fn = std::move(fn);
+        }
+
+    public:
+        reactor()
+        {
+            _epoll = epoll_create1(EPOLL_CLOEXEC);
+            if (_epoll < 0)
+                fail("epoll_create1");
+            _wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (_wake < 0)
+            {
+                ::close(_epoll);
+                fail("eventfd");
+            }
+
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.u64 = wake_key;
+            epoll_ctl(_epoll, EPOLL_CTL_ADD, _wake, &ev);
+        }
+
+        ~reactor()
+        {
+            for (size_t fd = 0; fd < _slots.size(); ++fd)
+                if (_slots[fd].active && _slots[fd].owned)
+                    ::close(int(fd));
+            ::close(_wake);
+            ::close(_epoll);
+        }
+
+        reactor(const reactor&) = delete;
+        reactor& operator=(const reactor&) = delete;
+
+        // Calls f(events) whenever fd is ready for events (EPOLLIN, EPOLLOUT, ...).
+        // The reactor does not take ownership of fd.
+        template <class F>
+        void add(int fd, uint32_t events, F&& f)
+        {
+            // Everything that can throw happens before fd is registered, so a
+            // failed add leaves nothing behind.
+            handler fn(std::forward<F>(f));
+            if (size_t(fd) >= _slots.size())
+                _slots.resize(fd + 1);
+            auto& s = _slots[fd];
+            if (s.active)
+                throw std::system_error(std::make_error_code(std::errc::file_exists), "reactor::add");
+
+            ++s.generation;
+            control(EPOLL_CTL_ADD, fd, events);
+            s.fn = std::move(fn);
+            s.active = true;
+            s.owned = false;
+        }
+
+        void modify(int fd, uint32_t events)
+        {
+            control(EPOLL_CTL_MOD, fd, events);
+        }
+
+        // Unregisters fd and destroys its handler. Pending events for fd in
+        // the current batch are discarded.
+        void remove(int fd)
+        {
+            if (size_t(fd) >= _slots.size() || !_slots[fd].active)
+                return;
+
+            auto& s = _slots[fd];
+            epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+            ++s.generation;
+            s.active = false;
+            s.fn = handler();
+            if (s.owned)
+                ::close(fd);
+        }
+
+        // Calls f() after first, then every period if it is non zero. Returns
+        // an id for cancel_timer().
+        template <class F>
+        int add_timer(std::chrono::nanoseconds first, std::chrono::nanoseconds period, F&& f)
+        {
+            int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if (fd < 0)
+                fail("timerfd_create");
+
+            auto to_timespec = [](std::chrono::nanoseconds d) {
+                return timespec{ time_t(d.count() / 1000000000), long(d.count() % 1000000000) };
+            };
+            itimerspec spec{};
+            spec.it_value = to_timespec(first.count() > 0 ? first : std::chrono::nanoseconds(1));
+            spec.it_interval = to_timespec(period);
+
+            try
+            {
+                if (timerfd_settime(fd, 0, &spec, nullptr) != 0)
+                    fail("timerfd_settime");
+                add(fd, EPOLLIN, [fd, f = std::forward<F>(f)](uint32_t) mutable {
+                    uint64_t expirations;
+                    if (::read(fd, &expirations, sizeof(expirations)) > 0)
+                        f();
+                });
+            }
+            catch (...)
+            {
+                ::close(fd);
+                throw;
+            }
+            _slots[fd].owned = true;
+            return fd;
+        }
+
+        void cancel_timer(int id) { remove(id); }
+
+        // Runs f on the reactor thread. Safe to call from any thread.
+        template <class F>
+        void post(F&& f)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_posted_mutex);
+                _posted.emplace_back(std::forward<F>(f));
+            }
+            uint64_t one = 1;
+            (void)!::write(_wake, &one, sizeof(one));
+        }
+
+        // Runs work() on executor, then then(result) (or then() for void work)
+        // back on the reactor thread. The reactor must outlive the work.
+        template <class F, class C>
+        void offload(task_system& executor, F&& work, C&& then)
+        {
+            executor.async_([this, work = std::forward<F>(work), then = std::forward<C>(then)]() mutable {
+                if constexpr (std::is_void_v<std::invoke_result_t<F&>>)
+                {
+                    work();
+                    post(std::move(then));
+                }
+                else
+                    post([then = std::move(then), r = work()]() mutable { then(std::move(r)); });
+            });
+        }
+
+        // Waits up to timeout_ms (-1 for no limit) and runs the ready handlers
+        // and posted tasks. Returns the number run.
+        size_t run_once(int timeout_ms = -1)
+        {
+            epoll_event events[max_events];
+            int n = epoll_wait(_epoll, events, max_events, timeout_ms);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    return 0;
+                fail("epoll_wait");
+            }
+
+            size_t count = 0;
+            for (int i = 0; i < n; ++i)
+            {
+                if (events[i].data.u64 == wake_key)
+                    count += run_posted();
+                else
+                {
+                    dispatch(events[i].data.u64, events[i].events);
+                    ++count;
+                }
+            }
+            return count;
+        }
+
+        // Runs the loop until stop(). Returns at once if stop() was called
+        // since the last run() returned; the next run() starts afresh.
+        void run()
+        {
+            while (!_stop.load(std::memory_order_acquire))
+                run_once();
+            _stop.store(false, std::memory_order_relaxed);
+        }
+
+        // Makes the current or next run() return. Safe to call from any thread.
+        void stop()
+        {
+            _stop.store(true, std::memory_order_release);
+            uint64_t one = 1;
+            (void)!::write(_wake, &one, sizeof(one));
+        }
+    };
+
+} // namespace poly
+
+#endif
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace poly
+{
+    // Destroys heap objects on a background thread so that expensive
+    // destructors and frees stay off latency critical threads.
+    //
+    // retire() appends to a batch owned by the calling thread, which is handed
+    // to the background thread once it holds batch_size objects, on flush(),
+    // or when the thread exits. The objects' destructors therefore run on
+    // another thread, after a delay, in no particular order relative to other
+    // threads' objects.
+    //
+    // The background thread starts on first use and, at exit, destroys
+    // whatever was handed to it. Threads other than main must flush() or exit
+    // before static destruction.
+    class reclaimer
+    {
+    public:
+        static constexpr size_t batch_size = 64;
+
+        // Throws, keeping ownership with the caller, only when the calling
+        // thread's batch can not be created or grown.
+        template<typename T>
+        static void retire(T* p)
+        {
+            local().push({ p, &destroy<T> });
+        }
+
+        // For noexcept callers: returns false instead of throwing, and the
+        // caller still owns p.
+        template<typename T>
+        static bool try_retire(T* p) noexcept
+        {
+            try {
+                retire(p);
+                return true;
+            } catch (...) {
+                return false;
+            }
+        }
+
+        // Hands the calling thread's batch to the background thread.
+        static void flush() { local().flush(); }
+
+        // Flushes the calling thread's batch and waits until every object
+        // handed over so far has been destroyed.
+        static void synchronize()
+        {
+            flush();
+            auto& r = instance();
+            std::unique_lock<std::mutex> lock(r._mutex);
+            r._idle.wait(lock, [&] { return r._queue.empty() && !r._busy; });
+        }
+
+        reclaimer(const reclaimer&) = delete;
+        reclaimer& operator=(const reclaimer&) = delete;
+
+    private:
+        struct item {
+            void* p;
+            void(*destroy)(void*) noexcept;
+        };
+
+        struct batch {
+            std::vector<item> items;
+
+            batch() { items.reserve(batch_size); }
+            ~batch() { flush(); }
+
+            // Once stored, the item belongs to the batch: a failed hand over
+            // (starting the background thread or growing its queue) keeps
+            // it here for the next flush.
+            void push(item i)
+            {
+                items.push_back(i);
+                if (items.size() >= batch_size)
+                {
+                    try {
+                        flush();
+                    } catch (...) {}
+                }
+            }
+
+            void flush()
+            {
+                if (!items.empty())
+                    instance().take(items);
+            }
+        };
+
+        std::mutex _mutex;
+        std::condition_variable _ready;
+        std::condition_variable _idle;
+        std::vector<item> _queue;
+        bool _busy = false;
+        bool _stop = false;
+        std::thread _thread;
+
+        template<typename T>
+        static void destroy(void* p) noexcept { delete static_cast<T*>(p); }
+
+        static reclaimer& instance()
+        {
+            static reclaimer r;
+            return r;
+        }
+
+        static batch& local()
+        {
+            thread_local batch b;
+            return b;
+        }
+
+        reclaimer() : _thread([this] { run(); }) {}
+
+        ~reclaimer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _ready.notify_one();
+            _thread.join();
+        }
+
+        void take(std::vector<item>& items)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _queue.insert(_queue.end(), items.begin(), items.end());
+            }
+            items.clear();
+            _ready.notify_one();
+        }
+
+        void run()
+        {
+            std::vector<item> work;
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true)
+            {
+                _ready.wait(lock, [&] { return _stop || !_queue.empty(); });
+                if (_queue.empty())
+                    break;
+
+                work.swap(_queue);
+                _busy = true;
+                lock.unlock();
+                for (auto& i : work)
+                    i.destroy(i.p);
+                work.clear();
+                lock.lock();
+                _busy = false;
+                if (_queue.empty())
+                    _idle.notify_all();
+            }
+        }
+    };
+
+} // namespace poly
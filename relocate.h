@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "cpu.h"
+
+#ifndef POLY_STREAM_THRESHOLD
+// Relocations moving at least this many bytes in total, in one copy or in a
+// relocation_batch, bypass the cache with non-temporal stores.
+#define POLY_STREAM_THRESHOLD (256 * 1024)
+#endif
+
+#ifndef POLY_STREAM_MIN
+// Copies smaller than this are never streamed. bench_relocate_bytes, which
+// copies from and to memory, has the streaming kernels overtake memcpy at
+// about 4 KiB; below that the aligned head and tail dominate.
+#define POLY_STREAM_MIN (4 * 1024)
+#endif
+
+namespace poly
+{
+    using copy_kernel = void(*)(void* dest, const void* src, size_t n) noexcept;
+
+    inline void copy_portable(void* dest, const void* src, size_t n) noexcept
+    {
+        std::memcpy(dest, src, n);
+    }
+
+    POLY_TARGET_AVX2
+    inline void copy_stream_avx2(void* dest, const void* src, size_t n) noexcept
+    {
+#if POLY_X86
+        auto d = static_cast<char*>(dest);
+        auto s = static_cast<const char*>(src);
+
+        // Streaming stores need an aligned destination.
+        size_t head = (32 - (reinterpret_cast<uintptr_t>(d) & 31)) & 31;
+        if (head > n) head = n;
+        std::memcpy(d, s, head);
+        d += head; s += head; n -= head;
+
+        for (; n >= 128; n -= 128, d += 128, s += 128)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 32));
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 64));
+            __m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 96));
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(d), a);
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(d + 32), b);
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(d + 64), c);
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(d + 96), e);
+        }
+        for (; n >= 32; n -= 32, d += 32, s += 32)
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(d),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s)));
+
+        _mm_sfence();
+        std::memcpy(d, s, n);
+#else
+        copy_portable(dest, src, n);
+#endif
+    }
+
+    POLY_TARGET_AVX512
+    inline void copy_stream_avx512(void* dest, const void* src, size_t n) noexcept
+    {
+#if POLY_X86
+        auto d = static_cast<char*>(dest);
+        auto s = static_cast<const char*>(src);
+
+        size_t head = (64 - (reinterpret_cast<uintptr_t>(d) & 63)) & 63;
+        if (head > n) head = n;
+        std::memcpy(d, s, head);
+        d += head; s += head; n -= head;
+
+        for (; n >= 256; n -= 256, d += 256, s += 256)
+        {
+            __m512i a = _mm512_loadu_si512(s);
+            __m512i b = _mm512_loadu_si512(s + 64);
+            __m512i c = _mm512_loadu_si512(s + 128);
+            __m512i e = _mm512_loadu_si512(s + 192);
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(d), a);
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(d + 64), b);
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(d + 128), c);
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(d + 192), e);
+        }
+        for (; n >= 64; n -= 64, d += 64, s += 64)
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(d), _mm512_loadu_si512(s));
+
+        _mm_sfence();
+        std::memcpy(d, s, n);
+#else
+        copy_portable(dest, src, n);
+#endif
+    }
+
+    inline copy_kernel select_stream_kernel() noexcept
+    {
+        if (cpu().avx512f) return &copy_stream_avx512;
+        if (cpu().avx2) return &copy_stream_avx2;
+        return &copy_portable;
+    }
+
+    // The kernel used for large copies, chosen on first use.
+    inline copy_kernel stream_copy() noexcept
+    {
+        static const copy_kernel kernel = select_stream_kernel();
+        return kernel;
+    }
+
+    namespace detail
+    {
+        inline thread_local size_t relocation_batch_bytes = 0;
+    }
+
+    // Declares that the calling thread is about to relocate about bytes in
+    // total, e.g. while permuting or compacting a range. A single object is
+    // rarely large enough to be worth streaming, and a hot one never is, but
+    // a batch larger than the cache evicts the working set either way. The
+    // algorithms in algorithm.h declare their batches; growing a vector of
+    // large trivially copyable inline objects can be wrapped the same way.
+    class relocation_batch
+    {
+        size_t _prev;
+    public:
+        explicit relocation_batch(size_t bytes) noexcept : _prev(detail::relocation_batch_bytes)
+        {
+            detail::relocation_batch_bytes = bytes;
+        }
+        ~relocation_batch() { detail::relocation_batch_bytes = _prev; }
+        relocation_batch(const relocation_batch&) = delete;
+        relocation_batch& operator=(const relocation_batch&) = delete;
+    };
+
+    // Byte copy used when relocating trivially relocatable payloads. Copies
+    // stay in cache unless they, or the relocation_batch they belong to, are
+    // at least POLY_STREAM_THRESHOLD bytes and they are at least
+    // POLY_STREAM_MIN bytes themselves; those are streamed so they do not
+    // evict the working set.
+    inline void relocate_bytes(void* dest, const void* src, size_t n) noexcept
+    {
+        if (n < POLY_STREAM_MIN ||
+            (n < POLY_STREAM_THRESHOLD && detail::relocation_batch_bytes < POLY_STREAM_THRESHOLD))
+            std::memcpy(dest, src, n);
+        else
+            stream_copy()(dest, src, n);
+    }
+
+} // namespace poly
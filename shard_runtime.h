@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "spsc_ring.h"
+#include "task.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace poly
+{
+    // Thread per core runtime. Each shard runs its own loop on its own
+    // thread, and work is sent to a shard as a task<void()> rather than shared
+    // behind locks.
+    //
+    // Every (source, destination) pair of shards that has exchanged messages
+    // has its own SPSC ring, so cross-shard messages never contend. The ring
+    // is allocated by the source on its first message to the destination.
+    // Messages sent from a shard are staged and published once per pass of
+    // the sender's loop. Threads that are not shards, and shards whose ring
+    // to the destination is full, use the destination's locked inbox; those
+    // messages may be reordered relative to the ring.
+    //
+    // A count of messages sent but not yet run is kept, updated once per
+    // pass for the messages a shard sends and runs, so the shards can tell
+    // when the whole runtime is quiescent.
+    class shard_runtime
+    {
+    public:
+        using message = ::task<void()>;
+        static constexpr size_t ring_capacity = 256;
+        static constexpr size_t pass_batch = ring_capacity;     // messages taken from each ring per pass
+
+    private:
+        using ring = spsc_ring<message, ring_capacity>;
+
+        struct shard {
+            std::thread thread;
+            std::mutex inbox_mutex;
+            std::vector<message> inbox;
+            std::atomic<bool> has_inbox{ false };
+            size_t staged = 0;                      // owner only: unpublished outgoing messages
+        };
+
+        struct current {
+            const shard_runtime* owner = nullptr;
+            unsigned index = 0;
+        };
+
+        const unsigned _count;
+        std::unique_ptr<std::atomic<ring*>[]> _rings;   // _rings[src * _count + dst], null until first used
+        std::vector<std::unique_ptr<shard>> _shards;
+        std::atomic<size_t> _in_flight{ 0 };
+        std::atomic<bool> _stop{ false };
+
+        static current& local() noexcept
+        {
+            thread_local current c;
+            return c;
+        }
+
+        ring* channel(unsigned src, unsigned dst) const noexcept
+        {
+            return _rings[src * _count + dst].load(std::memory_order_acquire);
+        }
+
+        // Called by shard src only.
+        ring& open_channel(unsigned src, unsigned dst)
+        {
+            if (ring* r = channel(src, dst))
+                return *r;
+            auto r = new ring;
+            _rings[src * _count + dst].store(r, std::memory_order_release);
+            return *r;
+        }
+
+        void post_inbox(unsigned dst, message&& m)
+        {
+            _in_flight.fetch_add(1, std::memory_order_relaxed);
+            auto& s = *_shards[dst];
+            std::lock_guard<std::mutex> lock(s.inbox_mutex);
+            s.inbox.push_back(std::move(m));
+            s.has_inbox.store(true, std::memory_order_release);
+        }
+
+        // Runs the messages currently queued for shard i. Returns the number run.
+        size_t pass(unsigned i, std::vector<message>& inbox)
+        {
+            size_t count = 0;
+            auto run = [](message&& m) { m(); };
+            for (unsigned src = 0; src < _count; ++src)
+                if (ring* r = channel(src, i))
+                    count += r->consume(run, pass_batch);
+
+            auto& s = *_shards[i];
+            if (s.has_inbox.load(std::memory_order_acquire))
+            {
+                {
+                    std::lock_guard<std::mutex> lock(s.inbox_mutex);
+                    inbox.swap(s.inbox);
+                    s.has_inbox.store(false, std::memory_order_relaxed);
+                }
+                for (auto& m : inbox)
+                    m();
+                count += inbox.size();
+                inbox.clear();
+            }
+
+            // Count the sent messages before they become visible, and before
+            // taking off the ones that ran, so the count never drops to zero
+            // while a message is still queued.
+            if (s.staged)
+            {
+                _in_flight.fetch_add(s.staged, std::memory_order_relaxed);
+                for (unsigned dst = 0; dst < _count; ++dst)
+                    if (ring* r = channel(i, dst))
+                        r->publish();
+                s.staged = 0;
+            }
+            if (count)
+                _in_flight.fetch_sub(count, std::memory_order_acq_rel);
+            return count;
+        }
+
+        void run(unsigned i)
+        {
+            local() = { this, i };
+            std::vector<message> inbox;
+            unsigned idle = 0;
+
+            while (true)
+            {
+                if (pass(i, inbox))
+                {
+                    idle = 0;
+                    continue;
+                }
+                if (_stop.load(std::memory_order_acquire) && _in_flight.load(std::memory_order_acquire) == 0)
+                    break;
+
+                if (++idle < 64)
+                    std::this_thread::yield();
+                else
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+            local() = {};
+        }
+
+        void pin(unsigned i)
+        {
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i % std::max(1u, std::thread::hardware_concurrency()), &set);
+            pthread_setaffinity_np(_shards[i]->thread.native_handle(), sizeof(set), &set);
+#else
+            (void)i;
+#endif
+        }
+
+    public:
+        // Starts count shards. With pin_threads, shard i is bound to core i.
+        explicit shard_runtime(unsigned count = std::max(1u, std::thread::hardware_concurrency()), bool pin_threads = false)
+            : _count(count)
+            , _rings(new std::atomic<ring*>[size_t(count) * count])
+        {
+            for (size_t i = 0; i < size_t(count) * count; ++i)
+                _rings[i].store(nullptr, std::memory_order_relaxed);
+            for (unsigned i = 0; i < _count; ++i)
+                _shards.push_back(std::make_unique<shard>());
+            for (unsigned i = 0; i < _count; ++i)
+            {
+                _shards[i]->thread = std::thread([this, i] { run(i); });
+                if (pin_threads)
+                    pin(i);
+            }
+        }
+
+        // Runs every message sent before the call, and every message those
+        // send in turn, then stops the shards.
+        ~shard_runtime()
+        {
+            _stop.store(true, std::memory_order_release);
+            for (auto& s : _shards)
+                s->thread.join();
+            for (size_t i = 0; i < size_t(_count) * _count; ++i)
+                delete _rings[i].load(std::memory_order_relaxed);
+        }
+
+        shard_runtime(const shard_runtime&) = delete;
+        shard_runtime& operator=(const shard_runtime&) = delete;
+
+        unsigned size() const noexcept { return _count; }
+
+        // Index of the calling shard, or -1 on any other thread.
+        int current_shard() const noexcept
+        {
+            auto& c = local();
+            return c.owner == this ? int(c.index) : -1;
+        }
+
+        // Runs f on shard dst.
+        template <class F>
+        void submit_to(unsigned dst, F&& f)
+        {
+            auto& c = local();
+            if (c.owner == this)
+            {
+                // stage() only constructs from f once it has a free slot.
+                if (open_channel(c.index, dst).stage(std::forward<F>(f)))
+                {
+                    ++_shards[c.index]->staged;
+                    return;
+                }
+            }
+            post_inbox(dst, message(std::forward<F>(f)));
+        }
+    };
+
+} // namespace poly
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "task.h"
+
+namespace poly
+{
+    template <class>
+    class signal;
+
+    // Observer list whose handlers are task<void(Args...)> objects stored
+    // contiguously, so emitting walks one array and small handlers never
+    // allocate. connect() returns a handle of (slot index, generation);
+    // disconnect() swap-removes the handler in O(1), and a stale handle is
+    // ignored.
+    //
+    // Handlers may connect and disconnect while the signal is emitting. A
+    // disconnected handler is not called again, but its removal, and the
+    // insertion of new handlers, wait until the outermost emit returns.
+    template <class... Args>
+    class signal<void(Args...)>
+    {
+    public:
+        using handler = ::task<void(Args...)>;
+
+        struct connection {
+            uint32_t index = ~uint32_t(0);
+            uint32_t generation = 0;
+
+            uint64_t value() const noexcept { return (uint64_t(generation) << 32) | index; }
+            explicit operator bool() const noexcept { return index != ~uint32_t(0); }
+        };
+
+    private:
+        static constexpr uint32_t pending = ~uint32_t(0);
+
+        struct entry {
+            handler fn;
+            uint32_t slot;
+            bool live;
+        };
+
+        struct slot {
+            uint32_t dense = pending;   // position in _entries, pending until inserted
+            uint32_t generation = 0;
+        };
+
+        std::vector<entry> _entries;
+        std::vector<slot> _slots;
+        std::vector<uint32_t> _free;
+        unsigned _emitting = 0;
+        std::vector<entry> _added;
+        std::vector<uint32_t> _removed;
+
+        bool valid(connection c) const noexcept
+        {
+            return c.index < _slots.size() && _slots[c.index].generation == c.generation;
+        }
+
+        void erase(uint32_t s)
+        {
+            uint32_t i = _slots[s].dense;
+            if (i != uint32_t(_entries.size() - 1))
+            {
+                _entries[i] = std::move(_entries.back());
+                _slots[_entries[i].slot].dense = i;
+            }
+            _entries.pop_back();
+            _slots[s].dense = pending;
+            _free.push_back(s);
+        }
+
+        void apply_deferred()
+        {
+            for (auto s : _removed)
+            {
+                if (_slots[s].dense != pending)
+                    erase(s);
+                else
+                    _free.push_back(s);     // connected and disconnected within the same emit
+            }
+            _removed.clear();
+
+            for (auto& e : _added)
+            {
+                if (!e.live)
+                    continue;
+                _slots[e.slot].dense = uint32_t(_entries.size());
+                _entries.push_back(std::move(e));
+            }
+            _added.clear();
+        }
+
+    public:
+        signal() = default;
+        signal(const signal&) = delete;
+        signal& operator=(const signal&) = delete;
+
+        template <class F>
+        connection connect(F&& f)
+        {
+            uint32_t s;
+            if (_free.empty())
+            {
+                s = uint32_t(_slots.size());
+                _slots.emplace_back();
+            }
+            else
+            {
+                s = _free.back();
+                _free.pop_back();
+            }
+
+            entry e{ handler(std::forward<F>(f)), s, true };
+            if (_emitting)
+                _added.push_back(std::move(e));
+            else
+            {
+                _slots[s].dense = uint32_t(_entries.size());
+                _entries.push_back(std::move(e));
+            }
+            return { s, _slots[s].generation };
+        }
+
+        // Returns false if c was already disconnected.
+        bool disconnect(connection c)
+        {
+            if (!valid(c))
+                return false;
+
+            auto& s = _slots[c.index];
+            ++s.generation;
+            if (!_emitting)
+            {
+                erase(c.index);
+                return true;
+            }
+
+            if (s.dense != pending)
+                _entries[s.dense].live = false;
+            else
+                for (auto& e : _added)
+                    if (e.slot == c.index)
+                        e.live = false;
+            _removed.push_back(c.index);
+            return true;
+        }
+
+        bool connected(connection c) const noexcept { return valid(c); }
+
+        void disconnect_all()
+        {
+            // From the back, since disconnecting outside emit swap-removes.
+            for (size_t i = _entries.size(); i-- > 0;)
+                if (_entries[i].live)
+                    disconnect({ _entries[i].slot, _slots[_entries[i].slot].generation });
+            for (auto& e : _added)
+                if (e.live)
+                    disconnect({ e.slot, _slots[e.slot].generation });
+        }
+
+        // Calls every connected handler in connection order, except that a
+        // disconnect moves the last handler into the freed position.
+        void emit(Args... args)
+        {
+            struct guard {
+                signal& s;
+                ~guard() { if (--s._emitting == 0) s.apply_deferred(); }
+            } g{ *this };
+            ++_emitting;
+
+            // Insertions are deferred, so _entries neither grows nor moves here.
+            const size_t n = _entries.size();
+            for (size_t i = 0; i < n; ++i)
+                if (_entries[i].live)
+                    _entries[i].fn(args...);
+        }
+
+        void operator()(Args... args) { emit(args...); }
+
+        size_t size() const noexcept { return _entries.size() + _added.size() - _removed.size(); }
+        bool empty() const noexcept { return size() == 0; }
+    };
+
+} // namespace poly
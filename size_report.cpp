@@ -0,0 +1,103 @@
+// Lists the size records that POLY_SIZE_REPORT embeds in a binary. Standalone,
+// e.g.
+//   g++ -std=c++17 -O2 size_report.cpp -o size_report
+//   ./size_report app       prints the records of app, built with -DPOLY_SIZE_REPORT
+//   ./size_report           checks that the records of this program are found
+//
+// The records are found by scanning the whole file for their magic, so this
+// works whether or not the compiler placed them in the poly_size section.
+#define POLY_SIZE_REPORT
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "unique_ptr_v2.h"
+
+namespace
+{
+    using poly_v2::size_record;
+
+    std::vector<size_record> read_records(const char* path)
+    {
+        std::vector<size_record> records;
+        std::FILE* f = std::fopen(path, "rb");
+        if (!f)
+            return records;
+        std::vector<char> bytes;
+        char chunk[1 << 16];
+        for (size_t n; (n = std::fread(chunk, 1, sizeof(chunk), f)) != 0;)
+            bytes.insert(bytes.end(), chunk, chunk + n);
+        std::fclose(f);
+
+        // Other copies of the magic, such as the string literal below, are
+        // not followed by a plausible record.
+        std::map<std::string, size_record> unique;
+        for (size_t i = 0; i + sizeof(size_record) <= bytes.size(); ++i)
+        {
+            if (std::memcmp(&bytes[i], "polysz1", 8) != 0)
+                continue;
+            size_record r;
+            std::memcpy(&r, &bytes[i], sizeof(r));
+            if (r.is_inline > 1 || !std::memchr(r.name, 0, sizeof(r.name)) ||
+                !std::strstr(r.name, "size_report<"))
+                continue;
+            unique.emplace(r.name, r);
+        }
+        for (auto& r : unique)
+            records.push_back(r.second);
+        return records;
+    }
+
+    struct base { virtual ~base() = default; };
+    struct small : base { int v = 0; };
+    struct large : base { char bytes[500] = {}; };
+
+    bool has(const std::vector<size_record>& records, size_t model_size, size_t capacity, bool is_inline)
+    {
+        for (auto& r : records)
+            if (r.model_size == model_size && r.capacity == capacity && r.is_inline == is_inline)
+                return true;
+        return false;
+    }
+
+    int check_self(const char* path)
+    {
+        poly_v2::unique_ptr<base, 64> a;
+        a.emplace<small>();
+        a.emplace<large>();
+        poly_v2::unique_ptr<base, 64, poly_v2::inline_below<8>> b;
+        b.emplace<small>();
+
+        auto records = read_records(path);
+        int failures = 0;
+        auto expect = [&](bool ok, const char* what) {
+            if (!ok) {
+                std::printf("missing record: %s\n", what);
+                ++failures;
+            }
+        };
+        expect(has(records, sizeof(poly_v2::inline_model<small, base>), 64, true), "small in 64 bytes");
+        expect(has(records, sizeof(poly_v2::inline_model<large, base>), 64, false), "large in 64 bytes");
+        expect(has(records, sizeof(poly_v2::inline_model<small, base>), 8, false), "small below 8 bytes");
+        if (failures == 0)
+            std::printf("all size records found\n");
+        return failures;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+#if defined(__linux__)
+        return check_self("/proc/self/exe");
+#else
+        return check_self(argv[0]);
+#endif
+    }
+
+    for (auto& r : read_records(argv[1]))
+        std::printf("%s %5llu of %5llu  %s\n", r.is_inline ? "inline" : "heap  ",
+            (unsigned long long)r.model_size, (unsigned long long)r.capacity, r.name);
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "unique_ptr_v2.h"
+
+namespace poly
+{
+    // Dense array of poly_v2::unique_ptr<T, N> addressed through stable
+    // handles. Insert, erase and lookup are O(1), and iteration walks the
+    // payloads contiguously.
+    //
+    // A handle packs a slot index and the slot's generation into 64 bits. The
+    // slot records where its payload currently sits in the dense array; erase
+    // relocates the last payload into the hole with one _relocate call and
+    // bumps the generation, so stale handles stop resolving.
+    template<typename T, size_t N = 128, typename policy = poly_v2::may_spill>
+    class slot_map
+    {
+    public:
+        using value_type = poly_v2::unique_ptr<T, N, policy>;
+        using iterator = typename std::vector<value_type>::iterator;
+        using const_iterator = typename std::vector<value_type>::const_iterator;
+
+        struct handle {
+            uint32_t index = ~uint32_t(0);
+            uint32_t generation = 0;
+
+            uint64_t value() const noexcept { return (uint64_t(generation) << 32) | index; }
+            static handle from_value(uint64_t v) noexcept { return { uint32_t(v), uint32_t(v >> 32) }; }
+            explicit operator bool() const noexcept { return index != ~uint32_t(0); }
+            friend bool operator==(handle a, handle b) noexcept { return a.value() == b.value(); }
+            friend bool operator!=(handle a, handle b) noexcept { return !(a == b); }
+        };
+
+    private:
+        static constexpr uint32_t no_slot = ~uint32_t(0);
+
+        struct slot {
+            uint32_t dense;         // position in _dense, or the next free slot
+            uint32_t generation;
+        };
+
+        std::vector<value_type> _dense;
+        std::vector<uint32_t> _owner;       // _owner[i] is the slot of _dense[i]
+        std::vector<slot> _slots;
+        uint32_t _free = no_slot;
+        size_t _compact_next = 0;
+
+        bool valid(handle h) const noexcept
+        {
+            return h.index < _slots.size() && _slots[h.index].generation == h.generation;
+        }
+
+        // Takes a slot for the payload just appended to _dense.
+        handle bind()
+        {
+            uint32_t s;
+            if (_free != no_slot)
+            {
+                s = _free;
+                _free = _slots[s].dense;
+            }
+            else
+            {
+                s = uint32_t(_slots.size());
+                _slots.push_back({ 0, 0 });
+            }
+            _slots[s].dense = uint32_t(_dense.size() - 1);
+            _owner.push_back(s);
+            return { s, _slots[s].generation };
+        }
+
+    public:
+        slot_map() = default;
+        slot_map(slot_map&&) noexcept = default;
+        slot_map& operator=(slot_map&&) noexcept = default;
+
+        void reserve(size_t n)
+        {
+            _dense.reserve(n);
+            _owner.reserve(n);
+            _slots.reserve(n);
+        }
+
+        template<typename U, typename... Args>
+        handle emplace(Args&&... args)
+        {
+            _dense.emplace_back();
+            try
+            {
+                _dense.back().template emplace<U>(std::forward<Args>(args)...);
+                return bind();
+            }
+            catch (...)
+            {
+                _dense.pop_back();
+                throw;
+            }
+        }
+
+        template<typename U>
+        handle insert(U&& u)
+        {
+            _dense.emplace_back();
+            try
+            {
+                _dense.back() = std::forward<U>(u);
+                return bind();
+            }
+            catch (...)
+            {
+                _dense.pop_back();
+                throw;
+            }
+        }
+
+        handle insert(value_type&& p)
+        {
+            _dense.push_back(std::move(p));
+            try
+            {
+                return bind();
+            }
+            catch (...)
+            {
+                _dense.pop_back();
+                throw;
+            }
+        }
+
+        // Destroys the payload of h. Returns false if h is stale.
+        bool erase(handle h)
+        {
+            if (!valid(h))
+                return false;
+
+            auto& s = _slots[h.index];
+            uint32_t i = s.dense;
+            uint32_t last = uint32_t(_dense.size() - 1);
+            _dense[i].reset();
+            if (i != last)
+            {
+                poly_v2::relocation::move(_dense[last], _dense[i]);
+                _owner[i] = _owner[last];
+                _slots[_owner[i]].dense = i;
+            }
+            _dense.pop_back();
+            _owner.pop_back();
+
+            ++s.generation;
+            s.dense = _free;
+            _free = h.index;
+            return true;
+        }
+
+        bool contains(handle h) const noexcept { return valid(h); }
+
+        // The pointer holding h's payload, or nullptr if h is stale. Valid
+        // until the next insert or erase.
+        value_type* find(handle h) noexcept { return valid(h) ? &_dense[_slots[h.index].dense] : nullptr; }
+        const value_type* find(handle h) const noexcept { return valid(h) ? &_dense[_slots[h.index].dense] : nullptr; }
+
+        T* get(handle h) noexcept { auto p = find(h); return p ? p->get() : nullptr; }
+        const T* get(handle h) const noexcept { auto p = find(h); return p ? p->get() : nullptr; }
+
+        // The handle of the payload at dense position i.
+        handle handle_at(size_t i) const noexcept { return { _owner[i], _slots[_owner[i]].generation }; }
+
+        value_type& operator[](size_t i) noexcept { return _dense[i]; }
+        const value_type& operator[](size_t i) const noexcept { return _dense[i]; }
+
+        iterator begin() noexcept { return _dense.begin(); }
+        iterator end() noexcept { return _dense.end(); }
+        const_iterator begin() const noexcept { return _dense.begin(); }
+        const_iterator end() const noexcept { return _dense.end(); }
+
+        size_t size() const noexcept { return _dense.size(); }
+        bool empty() const noexcept { return _dense.empty(); }
+
+        // Moves up to budget spilled payloads, resuming where the last call
+        // stopped, back inline where they fit. The dense array never has holes,
+        // so this is the only compaction it needs. Returns true once a full
+        // pass has completed.
+        bool compact(size_t budget)
+        {
+            for (; budget && _compact_next < _dense.size(); --budget, ++_compact_next)
+                _dense[_compact_next].try_inline();
+
+            if (_compact_next < _dense.size())
+                return false;
+            _compact_next = 0;
+            return true;
+        }
+
+        // Destroys every payload and invalidates every handle.
+        void clear() noexcept
+        {
+            for (uint32_t s : _owner)
+            {
+                ++_slots[s].generation;
+                _slots[s].dense = _free;
+                _free = s;
+            }
+            _dense.clear();
+            _owner.clear();
+        }
+    };
+
+} // namespace poly
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "unique_ptr_v2.h"
+
+namespace poly_v2
+{
+    // Opt-in list of the members of U that are read every frame. They are
+    // declared in a separate struct that U does not contain, and specialized
+    // as a tuple of pointers to its members, e.g.
+    //
+    //   struct particle_hot { float x = 0, vx = 0; };
+    //   struct particle : entity { std::string name; ... };   // the cold part
+    //
+    //   template<> struct poly_v2::hot_members<particle> {
+    //       static constexpr auto value = std::make_tuple(&particle_hot::x, &particle_hot::vx);
+    //   };
+    //
+    // Types without a specialization have no hot columns.
+    template<typename U>
+    struct hot_members {
+        static constexpr std::tuple<> value{};
+    };
+
+    template<typename M> struct member_type;
+
+    template<typename C, typename V>
+    struct member_type<V C::*> {
+        using type = V;
+        using owner = C;
+    };
+
+    // The hot struct of a type without hot members.
+    struct no_hot_members {};
+
+    template<typename U>
+    using hot_tuple_t = std::decay_t<decltype(hot_members<U>::value)>;
+
+    template<typename Tuple> struct hot_columns;
+
+    template<>
+    struct hot_columns<std::tuple<>> {
+        using type = std::tuple<>;
+        using record = no_hot_members;
+    };
+
+    template<typename M0, typename... M>
+    struct hot_columns<std::tuple<M0, M...>> {
+        using type = std::tuple<std::vector<typename member_type<M0>::type>, std::vector<typename member_type<M>::type>...>;
+        using record = typename member_type<M0>::owner;
+
+        static_assert((std::is_same_v<typename member_type<M>::owner, record> && ...),
+            "hot members must all belong to the same struct");
+    };
+
+    // Structure of arrays storage for objects of a single concrete type U.
+    // The objects hold only the cold part and are stored by value in one
+    // contiguous array, so they are usable through T* without any type
+    // erasure. The hot members declared by hot_members<U> live permanently
+    // in one contiguous column each, indexed like the objects, which loops
+    // can vectorize over:
+    //
+    //   float* x = particles.column<0>();
+    //   const float* vx = particles.column<1>();
+    //   for (size_t i = 0; i < particles.size(); ++i)
+    //       x[i] += vx[i];
+    //
+    // Column pointers are invalidated by emplace_back() and reserve(), like
+    // vector iterators.
+    template<typename U, typename T>
+    class soa_vector
+    {
+        static_assert(is_acceptable<U, T>, "U must derive from T");
+
+        using members_type = hot_tuple_t<U>;
+        using columns_type = typename hot_columns<members_type>::type;
+        static constexpr size_t column_count = std::tuple_size_v<members_type>;
+
+        std::vector<U> _objects;
+        columns_type _columns;
+
+        // Calls fn(column, member pointer) for each hot member.
+        template<typename Columns, typename Fn, size_t... I>
+        static void each_column(Columns& columns, Fn&& fn, std::index_sequence<I...>) {
+            (fn(std::get<I>(columns), std::get<I>(hot_members<U>::value)), ...);
+        }
+
+        template<typename Fn>
+        void each_column(Fn&& fn) {
+            each_column(_columns, fn, std::make_index_sequence<column_count>{});
+        }
+
+        template<typename Fn>
+        void each_column(Fn&& fn) const {
+            each_column(_columns, fn, std::make_index_sequence<column_count>{});
+        }
+
+    public:
+
+        using value_type = U;
+        using hot_type = typename hot_columns<members_type>::record;
+
+        // Constructs the cold part from args; the hot members start out as
+        // in a value initialized hot_type.
+        template<typename... Args>
+        size_t emplace_back(Args&&... args)
+        {
+            _objects.emplace_back(std::forward<Args>(args)...);
+            try
+            {
+                hot_type init{};
+                each_column([&](auto& c, auto m) { c.push_back(init.*m); });
+            }
+            catch (...)
+            {
+                // Columns that grew before the failure are longer than _objects.
+                each_column([&](auto& c, auto) { c.resize(_objects.size() - 1); });
+                _objects.pop_back();
+                throw;
+            }
+            return _objects.size() - 1;
+        }
+
+        // Removes element i by moving the last element into its place.
+        void erase(size_t i)
+        {
+            if (i + 1 != _objects.size())
+            {
+                _objects[i] = std::move(_objects.back());
+                each_column([&](auto& c, auto) { c[i] = std::move(c.back()); });
+            }
+            _objects.pop_back();
+            each_column([](auto& c, auto) { c.pop_back(); });
+        }
+
+        void clear() noexcept
+        {
+            _objects.clear();
+            each_column([](auto& c, auto) { c.clear(); });
+        }
+
+        void reserve(size_t n)
+        {
+            _objects.reserve(n);
+            each_column([&](auto& c, auto) { c.reserve(n); });
+        }
+
+        size_t size() const noexcept { return _objects.size(); }
+        bool empty() const noexcept { return _objects.empty(); }
+
+        // Contiguous array of the I'th hot member, size() elements long.
+        template<size_t I>
+        auto* column() noexcept { return std::get<I>(_columns).data(); }
+
+        template<size_t I>
+        const auto* column() const noexcept { return std::get<I>(_columns).data(); }
+
+        // The I'th hot member of element i.
+        template<size_t I>
+        auto& hot(size_t i) noexcept { return std::get<I>(_columns)[i]; }
+
+        template<size_t I>
+        const auto& hot(size_t i) const noexcept { return std::get<I>(_columns)[i]; }
+
+        // Copies all the hot members of element i from or into a hot_type.
+        hot_type load_hot(size_t i) const
+        {
+            hot_type h{};
+            each_column([&](auto& c, auto m) { h.*m = c[i]; });
+            return h;
+        }
+
+        void store_hot(size_t i, const hot_type& h)
+        {
+            each_column([&](auto& c, auto m) { c[i] = h.*m; });
+        }
+
+        T* get(size_t i) noexcept { return &_objects[i]; }
+        const T* get(size_t i) const noexcept { return &_objects[i]; }
+    };
+
+    // A heterogeneous collection made of one soa_vector per concrete type.
+    template<typename T, typename... Us>
+    class soa_collection
+    {
+        std::tuple<soa_vector<Us, T>...> _vectors;
+
+    public:
+
+        template<typename U>
+        soa_vector<U, T>& of() noexcept { return std::get<soa_vector<U, T>>(_vectors); }
+
+        template<typename U, typename... Args>
+        size_t emplace_back(Args&&... args) {
+            return of<U>().emplace_back(std::forward<Args>(args)...);
+        }
+
+        size_t size() const noexcept {
+            return std::apply([](auto&... v) { return (size_t(0) + ... + v.size()); }, _vectors);
+        }
+
+        // Visit every object through its T interface, grouped by type. The
+        // hot members are reached through of<U>().
+        template<typename Fn>
+        void for_each(Fn&& fn)
+        {
+            std::apply([&](auto&... v) {
+                ((void)[&](auto& vec) {
+                    for (size_t i = 0; i < vec.size(); ++i)
+                        fn(*vec.get(i));
+                }(v), ...);
+            }, _vectors);
+        }
+    };
+
+} // namespace poly_v2
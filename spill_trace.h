@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstddef>
+
+#ifdef POLY_TRACK_SPILLS
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#if __has_include(<cxxabi.h>)
+#include <cstdlib>
+#include <cxxabi.h>
+#define POLY_HAS_CXXABI 1
+#endif
+#endif
+
+// Profiling support for finding which call sites spill objects to the heap.
+//
+// With POLY_TRACK_SPILLS defined, every heap allocation made because an object
+// did not fit inline (ptr_model and task's heap model) is recorded together
+// with the innermost spill_scope tag of the calling thread:
+//
+//   {
+//       poly::spill_scope scope("renderer/upload");
+//       ptr.emplace<large>("#3");
+//   }
+//   std::ofstream out("spills.folded");
+//   poly::dump_spills_folded(out);
+//
+// The output is in the folded stack format read by flamegraph.pl. Without
+// POLY_TRACK_SPILLS all of this compiles to nothing.
+namespace poly
+{
+#ifdef POLY_TRACK_SPILLS
+
+    struct spill_record {
+        const char* tag;
+        const char* type;
+        size_t size;
+    };
+
+    // Written only by its owning thread. Once full, the oldest records are overwritten.
+    struct spill_buffer {
+        static constexpr size_t capacity = 4096;
+        std::array<spill_record, capacity> records;
+        std::atomic<size_t> count{ 0 };
+    };
+
+    namespace detail
+    {
+        struct spill_registry {
+            std::mutex mutex;
+            std::vector<std::shared_ptr<spill_buffer>> buffers;
+        };
+
+        inline spill_registry& registry()
+        {
+            static spill_registry r;
+            return r;
+        }
+
+        inline spill_buffer& local_spill_buffer()
+        {
+            thread_local std::shared_ptr<spill_buffer> buffer = [] {
+                auto b = std::make_shared<spill_buffer>();
+                std::lock_guard<std::mutex> lock(registry().mutex);
+                registry().buffers.push_back(b);
+                return b;
+            }();
+            return *buffer;
+        }
+
+        inline thread_local const char* spill_tag = "untagged";
+
+        // Readable name of a type_info::name(), which GCC and Clang mangle.
+        inline std::string demangle(const char* name)
+        {
+#ifdef POLY_HAS_CXXABI
+            int status = 0;
+            std::unique_ptr<char, void(*)(void*)> r(abi::__cxa_demangle(name, nullptr, nullptr, &status), std::free);
+            if (status == 0 && r)
+                return r.get();
+#endif
+            return name;
+        }
+    }
+
+    // Attributes the spills of the current thread to tag while in scope.
+    class spill_scope
+    {
+        const char* _prev;
+    public:
+        explicit spill_scope(const char* tag) noexcept : _prev(detail::spill_tag) { detail::spill_tag = tag; }
+        ~spill_scope() { detail::spill_tag = _prev; }
+        spill_scope(const spill_scope&) = delete;
+        spill_scope& operator=(const spill_scope&) = delete;
+    };
+
+    // Called from noexcept moves. The first record of a thread allocates and
+    // registers its buffer; if that fails the record is lost and the next
+    // call tries again.
+    template<typename U>
+    void note_spill() noexcept
+    {
+        spill_buffer* buffer;
+        try {
+            buffer = &detail::local_spill_buffer();
+        } catch (...) {
+            return;
+        }
+        auto& b = *buffer;
+        auto n = b.count.load(std::memory_order_relaxed);
+        b.records[n % spill_buffer::capacity] = { detail::spill_tag, typeid(U).name(), sizeof(U) };
+        b.count.store(n + 1, std::memory_order_release);
+    }
+
+    // Writes "tag;type bytes" lines, summed over all threads. Records being
+    // written concurrently may be missed.
+    inline void dump_spills_folded(std::ostream& out)
+    {
+        std::map<std::string, size_t> totals;
+        std::map<const char*, std::string> names;
+        {
+            auto& r = detail::registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            for (auto& b : r.buffers)
+            {
+                auto n = b->count.load(std::memory_order_acquire);
+                auto first = n > spill_buffer::capacity ? n - spill_buffer::capacity : 0;
+                for (auto i = first; i < n; ++i)
+                {
+                    auto& rec = b->records[i % spill_buffer::capacity];
+                    auto name = names.find(rec.type);
+                    if (name == names.end())
+                        name = names.emplace(rec.type, detail::demangle(rec.type)).first;
+                    totals[std::string(rec.tag) + ";" + name->second] += rec.size;
+                }
+            }
+        }
+
+        for (auto& t : totals)
+            out << t.first << ' ' << t.second << '\n';
+    }
+
+#else
+
+    class spill_scope
+    {
+    public:
+        explicit spill_scope(const char*) noexcept {}
+    };
+
+    template<typename U>
+    void note_spill() noexcept {}
+
+#endif
+
+} // namespace poly
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace poly
+{
+    // Bounded single producer, single consumer ring of T. Elements are
+    // constructed in place in preallocated slots, so pushing never allocates.
+    //
+    // The producer may stage several elements and make them visible with one
+    // publish(); the consumer releases slots once per consume() batch.
+    template<typename T, size_t capacity>
+    class spsc_ring
+    {
+        static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+        using slot = std::aligned_storage_t<sizeof(T), alignof(T)>;
+        static constexpr size_t cache_line = 64;
+
+        alignas(cache_line) std::atomic<size_t> _head{ 0 };     // next slot to read, written by the consumer
+        alignas(cache_line) std::atomic<size_t> _tail{ 0 };     // end of the published slots, written by the producer
+        size_t _staged = 0;                                     // end of the staged slots, producer only
+        size_t _head_cache = 0;                                 // producer's copy of _head
+        alignas(cache_line) slot _slots[capacity];
+
+        T* at(size_t i) noexcept { return std::launder(reinterpret_cast<T*>(&_slots[i & (capacity - 1)])); }
+
+    public:
+        spsc_ring() = default;
+        spsc_ring(const spsc_ring&) = delete;
+        spsc_ring& operator=(const spsc_ring&) = delete;
+
+        ~spsc_ring()
+        {
+            publish();
+            consume([](T&&) {});
+        }
+
+        // Producer: constructs an element without making it visible. Returns
+        // false if the ring is full.
+        template<typename... A>
+        bool stage(A&&... args)
+        {
+            if (_staged - _head_cache == capacity)
+            {
+                _head_cache = _head.load(std::memory_order_acquire);
+                if (_staged - _head_cache == capacity)
+                    return false;
+            }
+            new (&_slots[_staged & (capacity - 1)]) T(std::forward<A>(args)...);
+            ++_staged;
+            return true;
+        }
+
+        // Producer: makes every staged element visible to the consumer.
+        void publish() noexcept { _tail.store(_staged, std::memory_order_release); }
+
+        template<typename... A>
+        bool try_push(A&&... args)
+        {
+            if (!stage(std::forward<A>(args)...))
+                return false;
+            publish();
+            return true;
+        }
+
+        // Consumer: passes up to max published elements to fn as rvalues and
+        // destroys them. Returns the number consumed.
+        template<typename Fn>
+        size_t consume(Fn&& fn, size_t max = capacity)
+        {
+            size_t head = _head.load(std::memory_order_relaxed);
+            size_t tail = _tail.load(std::memory_order_acquire);
+            size_t n = tail - head < max ? tail - head : max;
+            for (size_t i = 0; i < n; ++i)
+            {
+                T* t = at(head + i);
+                fn(std::move(*t));
+                t->~T();
+            }
+            if (n)
+                _head.store(head + n, std::memory_order_release);
+            return n;
+        }
+
+        bool empty() const noexcept
+        {
+            return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+        }
+    };
+
+} // namespace poly
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <thread>
+#include <utility>
+#include "block_cache.h"
+#include "task.h"
+#include "task_system.h"
+
+namespace poly
+{
+    // Runs the tasks posted to it one at a time, in the order they were
+    // posted, on a task_system. The tasks are kept in an unbounded intrusive
+    // MPSC queue (Vyukov's node queue): posting is one exchange and never
+    // waits, so a task may post to its own strand. Nodes come from a thread
+    // local block_cache, so posting does not go through the allocator once
+    // the cache is warm (unless the callable itself spills).
+    //
+    // The strand schedules itself on the executor only when its pending count
+    // goes from zero to one. Each run drains at most batch tasks, then yields
+    // the worker by rescheduling itself if more are pending.
+    class strand
+    {
+        struct node {
+            std::atomic<node*> next{ nullptr };
+            ::task<void()> t;
+        };
+
+        using cache = block_cache<size_class(sizeof(node)), alignof(node)>;
+        static constexpr size_t cache_line = 64;
+
+        task_system& _executor;
+        const size_t _batch;
+        alignas(cache_line) std::atomic<node*> _head;       // last posted node
+        alignas(cache_line) std::atomic<size_t> _pending{ 0 };
+        alignas(cache_line) node* _tail;                     // consumed node before the oldest, only touched by the running drain
+
+        template <class... A>
+        static node* make_node(A&&... args)
+        {
+            void* block = cache::allocate();
+            try {
+                return new (block) node{ {nullptr}, ::task<void()>(std::forward<A>(args)...) };
+            } catch (...) {
+                cache::deallocate(block);
+                throw;
+            }
+        }
+
+        static void free_node(node* n) noexcept
+        {
+            n->~node();
+            cache::deallocate(n);
+        }
+
+        void enqueue(node* n) noexcept
+        {
+            node* prev = _head.exchange(n, std::memory_order_acq_rel);
+            prev->next.store(n, std::memory_order_release);
+        }
+
+        // The oldest node becomes the new _tail once its task is moved out.
+        bool try_dequeue(::task<void()>& out)
+        {
+            node* next = _tail->next.load(std::memory_order_acquire);
+            if (!next)
+                return false;
+
+            out = std::move(next->t);
+            free_node(_tail);
+            _tail = next;
+            return true;
+        }
+
+        void schedule() { _executor.async_([this] { drain(); }); }
+
+        void drain()
+        {
+            size_t n = 0;
+            ::task<void()> t;
+            // A node that is posted but not linked yet is picked up by the
+            // rescheduled run.
+            while (n < _batch && try_dequeue(t))
+            {
+                t();
+                // Destroy the callable before the count below lets ~strand return.
+                t = {};
+                ++n;
+            }
+
+            if (_pending.fetch_sub(n, std::memory_order_acq_rel) != n)
+                schedule();
+        }
+
+    public:
+        explicit strand(task_system& executor, size_t batch = 64)
+            : _executor(executor)
+            , _batch(batch)
+            , _head(make_node())
+            , _tail(_head.load(std::memory_order_relaxed))
+        {}
+
+        // Waits for the posted tasks to finish.
+        ~strand()
+        {
+            while (_pending.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            free_node(_tail);
+        }
+
+        strand(const strand&) = delete;
+        strand& operator=(const strand&) = delete;
+
+        // Queues f. Never blocks, including when called from a task of this strand.
+        template <class F>
+        void post(F&& f)
+        {
+            node* n = make_node(std::forward<F>(f));
+            bool first = _pending.fetch_add(1, std::memory_order_acq_rel) == 0;
+            enqueue(n);
+            if (first)
+                schedule();
+        }
+    };
+
+} // namespace poly
@@ -1,29 +1,60 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <tuple>
 #include <type_traits>
+#include <vector>
+#include "block_cache.h"
+#include "spill_trace.h"
 
 using namespace std;
 
-template <class>
+// small_size is the size of the inline buffer. Larger callables are placed on the heap.
+template <class, size_t small_size = sizeof(void*) * 4>
 class task;
 
-template <class R, class... Args>
-class task<R(Args...)> {
+// Tag for constructing a task that must store its callable inline.
+struct inline_only_t {
+    explicit inline_only_t() = default;
+};
+constexpr inline_only_t inline_only{};
+
+template <class R, size_t small_size, class... Args>
+class task<R(Args...), small_size> {
     struct concept;
 
     template <class F, bool Small>
     struct model;
-    static constexpr size_t small_size = sizeof(void*) * 4;
 
-    static constexpr concept empty{ [](void*) noexcept {} };
+    // Invoking an empty task throws bad_function_call, like std::function.
+    static constexpr concept empty{ [](void*) noexcept {}, [](void*, void*) noexcept {},
+        [](void*, Args&&...) -> R { throw bad_function_call(); },
+        [](void* const*, size_t, R*, const decay_t<Args>*...) { throw bad_function_call(); } };
+
+    // Tasks can be invoked in batches when the result can be stored and the
+    // arguments can be packed into arrays, which default constructs them.
+    static constexpr size_t batch_chunk = 256;
+    static constexpr bool batchable = !is_void<R>::value && is_default_constructible<R>::value &&
+        ((is_copy_constructible<decay_t<Args>>::value && is_default_constructible<decay_t<Args>>::value) && ...);
+
+    template <class F, class = void>
+    struct has_batch_invoke : false_type {};
+    template <class F>
+    struct has_batch_invoke<F, void_t<decltype(&F::batch_invoke)>> : true_type {};
+
+    template <class F>
+    static void batch(F* const* fs, size_t n, R* out, const decay_t<Args>*... args);
 
     const concept* _concept = &empty;
     aligned_storage_t<small_size> _model;
 
 public:
+    task() noexcept = default;
+
     template <class F>
     task(F&& f) {
         constexpr bool is_small = sizeof(model<decay_t<F>, true>) <= small_size;
@@ -31,6 +62,14 @@ public:
         _concept = &model<decay_t<F>, is_small>::vtable;
     }
 
+    // Compile error instead of a heap allocation when F does not fit.
+    template <class F>
+    task(inline_only_t, F&& f) {
+        static_assert(sizeof(model<decay_t<F>, true>) <= small_size, "callable does not fit inline");
+        new (&_model) model<decay_t<F>, true>(forward<F>(f));
+        _concept = &model<decay_t<F>, true>::vtable;
+    }
+
     ~task() { _concept->_dtor(&_model); }
 
     task(task&& x) noexcept : _concept(x._concept) { _concept->_move(&x._model, &_model); }
@@ -42,18 +81,74 @@ public:
         return *this;
     }
     R operator()(Args... args) { return _concept->_invoke(&_model, forward<Args>(args)...); }
+
+    explicit operator bool() const noexcept { return _concept != &empty; }
+
+    // Computes out[i] = tasks[i](args[i]...) for i in [0, n). Tasks that wrap
+    // the same callable type are grouped by concept and handed to that type
+    // in one call, which lets a callable that provides
+    //
+    //   static void batch_invoke(const F* const* fs, size_t n, R* out, const Args*... args);
+    //
+    // run a vectorized kernel over the packed captures and arguments.
+    static void invoke_batch(task* tasks, size_t n, R* out, const decay_t<Args>*... args);
 };
 
-template <class R, class... Args>
-struct task<R(Args...)>::concept {
+template <class R, size_t small_size, class... Args>
+struct task<R(Args...), small_size>::concept {
     void(*_dtor)(void*) noexcept;
     void(*_move)(void*, void*) noexcept;
     R(*_invoke)(void*, Args&&...);
+    void(*_batch)(void* const*, size_t, R*, const decay_t<Args>*...);
 };
 
-template <class R, class... Args>
+template <class R, size_t small_size, class... Args>
+template <class F>
+void task<R(Args...), small_size>::batch(F* const* fs, size_t n, R* out, const decay_t<Args>*... args) {
+    if constexpr (!batchable) {
+        return;
+    } else if constexpr (has_batch_invoke<F>::value) {
+        F::batch_invoke(fs, n, out, args...);
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            tuple<decay_t<Args>...> a(args[i]...);
+            out[i] = apply([&](auto&... v) { return invoke(*fs[i], static_cast<Args&&>(v)...); }, a);
+        }
+    }
+}
+
+template <class R, size_t small_size, class... Args>
+void task<R(Args...), small_size>::invoke_batch(task* tasks, size_t n, R* out, const decay_t<Args>*... args) {
+    static_assert(batchable, "task signature can not be batched");
+    vector<size_t> order(n);
+    for (size_t i = 0; i < n; ++i) order[i] = i;
+    stable_sort(order.begin(), order.end(),
+        [&](size_t a, size_t b) { return less<const concept*>()(tasks[a]._concept, tasks[b]._concept); });
+
+    array<void*, batch_chunk> selves;
+    array<R, batch_chunk> results;
+    tuple<array<decay_t<Args>, batch_chunk>...> packed;
+
+    for (size_t begin = 0; begin < n;) {
+        const concept* c = tasks[order[begin]]._concept;
+        size_t count = 0;
+        while (begin + count < n && count < batch_chunk && tasks[order[begin + count]]._concept == c) {
+            size_t j = order[begin + count];
+            selves[count] = &tasks[j]._model;
+            apply([&](auto&... p) { ((p[count] = args[j]), ...); }, packed);
+            ++count;
+        }
+
+        apply([&](auto&... p) { c->_batch(selves.data(), count, results.data(), p.data()...); }, packed);
+
+        for (size_t i = 0; i < count; ++i) out[order[begin + i]] = move(results[i]);
+        begin += count;
+    }
+}
+
+template <class R, size_t small_size, class... Args>
 template <class F>
-struct task<R(Args...)>::model<F, true> {
+struct task<R(Args...), small_size>::model<F, true> {
     template <class G>
     model(G&& f) : _f(forward<G>(f)) {}
 
@@ -64,17 +159,45 @@ struct task<R(Args...)>::model<F, true> {
     static R _invoke(void* self, Args&&... args) {
         return invoke(static_cast<model*>(self)->_f, forward<Args>(args)...);
     }
+    static void _batch(void* const* selves, size_t n, R* out, const decay_t<Args>*... args) {
+        F* fs[batch_chunk];
+        for (size_t i = 0; i < n; ++i) fs[i] = &static_cast<model*>(selves[i])->_f;
+        batch(fs, n, out, args...);
+    }
 
-    static constexpr concept vtable{ _dtor, _move, _invoke };
+    static constexpr concept vtable{ _dtor, _move, _invoke, batchable ? _batch : nullptr };
 
     F _f;
 };
 
-template <class R, class... Args>
+// Callables that do not fit inline live in blocks from a thread local cache
+// of their size class, so repeatedly creating the same large task does not
+// go through the allocator.
+template <class R, size_t small_size, class... Args>
 template <class F>
-struct task<R(Args...)>::model<F, false> {
+struct task<R(Args...), small_size>::model<F, false> {
+    using cache = poly::block_cache<poly::size_class(sizeof(F)), alignof(F)>;
+
+    struct deleter {
+        void operator()(F* f) const noexcept {
+            f->~F();
+            cache::deallocate(f);
+        }
+    };
+
+    template <class G>
+    static F* make(G&& f) {
+        void* block = cache::allocate();
+        try {
+            return new (block) F(forward<G>(f));
+        } catch (...) {
+            cache::deallocate(block);
+            throw;
+        }
+    }
+
     template <class G>
-    model(G&& f) : _p(make_unique<F>(forward<F>(f))) {}
+    model(G&& f) : _p(make(forward<G>(f))) { poly::note_spill<F>(); }
 
     static void _dtor(void* self) noexcept { static_cast<model*>(self)->~model(); }
     static void _move(void* self, void* p) noexcept {
@@ -83,9 +206,14 @@ struct task<R(Args...)>::model<F, false> {
     static R _invoke(void* self, Args&&... args) {
         return invoke(*static_cast<model*>(self)->_p, forward<Args>(args)...);
     }
+    static void _batch(void* const* selves, size_t n, R* out, const decay_t<Args>*... args) {
+        F* fs[batch_chunk];
+        for (size_t i = 0; i < n; ++i) fs[i] = static_cast<model*>(selves[i])->_p.get();
+        batch(fs, n, out, args...);
+    }
 
-    static constexpr concept vtable{ _dtor, _move, _invoke };
+    static constexpr concept vtable{ _dtor, _move, _invoke, batchable ? _batch : nullptr };
 
-    unique_ptr<F> _p;
+    unique_ptr<F, deleter> _p;
 };
 
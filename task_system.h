@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "task.h"
+#include "trace.h"
+
+namespace poly
+{
+    // A queue per worker. Workers pop from their own queue first and steal
+    // from the others with try_pop before blocking.
+    class notification_queue
+    {
+    public:
+        struct item {
+            ::task<void()> fn;
+#ifdef POLY_TRACE
+            uint64_t id = 0;
+#endif
+        };
+
+    private:
+        std::deque<item> _q;
+        bool _done = false;
+        std::mutex _mutex;
+        std::condition_variable _ready;
+
+    public:
+        bool try_pop(item& x)
+        {
+            std::unique_lock<std::mutex> lock{ _mutex, std::try_to_lock };
+            if (!lock || _q.empty()) return false;
+            x = std::move(_q.front());
+            _q.pop_front();
+            return true;
+        }
+
+        bool try_push(item& x)
+        {
+            {
+                std::unique_lock<std::mutex> lock{ _mutex, std::try_to_lock };
+                if (!lock) return false;
+                _q.push_back(std::move(x));
+            }
+            _ready.notify_one();
+            return true;
+        }
+
+        void done()
+        {
+            {
+                std::lock_guard<std::mutex> lock{ _mutex };
+                _done = true;
+            }
+            _ready.notify_all();
+        }
+
+        bool pop(item& x)
+        {
+            std::unique_lock<std::mutex> lock{ _mutex };
+            if (_q.empty() && !_done)
+            {
+                POLY_TRACE_EVENT(park, 0);
+                while (_q.empty() && !_done) _ready.wait(lock);
+                POLY_TRACE_EVENT(unpark, 0);
+            }
+            if (_q.empty()) return false;
+            x = std::move(_q.front());
+            _q.pop_front();
+            return true;
+        }
+
+        void push(item& x)
+        {
+            {
+                std::lock_guard<std::mutex> lock{ _mutex };
+                _q.push_back(std::move(x));
+            }
+            _ready.notify_one();
+        }
+    };
+
+    // Work stealing thread pool running task<void()>.
+    class task_system
+    {
+        const unsigned _count;
+        std::vector<std::thread> _threads;
+        std::vector<notification_queue> _q;
+        std::atomic<unsigned> _index{ 0 };
+#ifdef POLY_TRACE
+        std::atomic<uint64_t> _next_id{ 0 };
+#endif
+
+        void run(unsigned i)
+        {
+            while (true)
+            {
+                notification_queue::item x;
+
+                for (unsigned n = 0; n != _count * 32; ++n)
+                {
+                    if (_q[(i + n) % _count].try_pop(x))
+                    {
+                        if ((i + n) % _count != i)
+                            POLY_TRACE_EVENT(steal, (i + n) % _count);
+                        break;
+                    }
+                }
+                if (!x.fn && !_q[i].pop(x)) break;
+
+                POLY_TRACE_EVENT(start, x.id);
+                x.fn();
+                POLY_TRACE_EVENT(end, x.id);
+            }
+        }
+
+    public:
+        explicit task_system(unsigned count = std::max(1u, std::thread::hardware_concurrency()))
+            : _count(count)
+            , _q(count)
+        {
+            for (unsigned n = 0; n != _count; ++n)
+                _threads.emplace_back([&, n] { run(n); });
+        }
+
+        ~task_system()
+        {
+            for (auto& e : _q) e.done();
+            for (auto& e : _threads) e.join();
+        }
+
+        task_system(const task_system&) = delete;
+        task_system& operator=(const task_system&) = delete;
+
+        unsigned size() const noexcept { return _count; }
+
+        template <class F>
+        void async_(F&& f)
+        {
+            notification_queue::item x{ ::task<void()>(std::forward<F>(f)) };
+#ifdef POLY_TRACE
+            x.id = _next_id.fetch_add(1, std::memory_order_relaxed);
+            POLY_TRACE_EVENT(submit, x.id);
+#endif
+            auto i = _index++;
+            for (unsigned n = 0; n != _count; ++n)
+                if (_q[(i + n) % _count].try_push(x)) return;
+
+            _q[i % _count].push(x);
+        }
+    };
+
+} // namespace poly
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstdint>
+
+// Compile time optional tracing of executor events.
+//
+// With POLY_TRACE defined, POLY_TRACE_EVENT appends a fixed size binary event
+// to a ring buffer owned by the calling thread. write_chrome_trace() exports
+// all buffers as Chrome trace_event JSON, viewable in chrome://tracing or
+// Perfetto. Without POLY_TRACE the macro expands to nothing.
+
+#ifdef POLY_TRACE
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define POLY_TRACE_RDTSC 1
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define POLY_TRACE_RDTSC 1
+#endif
+
+#define POLY_TRACE_EVENT(kind, arg) ::poly::trace::record(::poly::trace::event_kind::kind, (arg))
+
+namespace poly
+{
+    namespace trace
+    {
+        enum class event_kind : uint8_t {
+            submit,     // arg = task id
+            start,      // arg = task id
+            end,        // arg = task id
+            steal,      // arg = index of the queue stolen from
+            park,       // the worker found no work and blocks
+            unpark,
+        };
+
+        struct event {
+            uint64_t ticks;
+            uint64_t arg;
+            event_kind kind;
+        };
+
+        // Events of one thread. Only the owning thread writes; once full the
+        // oldest events are overwritten.
+        struct buffer {
+            static constexpr size_t capacity = 1 << 16;
+            std::array<event, capacity> events;
+            std::atomic<uint64_t> count{ 0 };
+            uint32_t tid = 0;
+        };
+
+        inline uint64_t now() noexcept
+        {
+#ifdef POLY_TRACE_RDTSC
+            return __rdtsc();
+#else
+            return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+        }
+
+        struct registry {
+            std::mutex mutex;
+            std::vector<std::shared_ptr<buffer>> buffers;
+
+            // Reference points for converting ticks to time.
+            uint64_t start_ticks = now();
+            std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+        };
+
+        inline registry& get_registry()
+        {
+            static registry r;
+            return r;
+        }
+
+        inline buffer& local_buffer()
+        {
+            thread_local std::shared_ptr<buffer> b = [] {
+                auto p = std::make_shared<buffer>();
+                auto& r = get_registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                p->tid = static_cast<uint32_t>(r.buffers.size());
+                r.buffers.push_back(p);
+                return p;
+            }();
+            return *b;
+        }
+
+        inline void record(event_kind kind, uint64_t arg) noexcept
+        {
+            auto& b = local_buffer();
+            auto n = b.count.load(std::memory_order_relaxed);
+            b.events[n % buffer::capacity] = { now(), arg, kind };
+            b.count.store(n + 1, std::memory_order_release);
+        }
+
+        // Writes every recorded event as Chrome trace_event JSON. Tasks become
+        // duration slices connected to their submission by flow arrows, so
+        // queueing delay is the length of the arrow. Call once the traced
+        // threads are quiescent.
+        inline void write_chrome_trace(std::ostream& out)
+        {
+            auto& r = get_registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+
+            double us_per_tick = 1;
+            auto ticks = now() - r.start_ticks;
+            auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - r.start_time);
+            if (ticks)
+                us_per_tick = elapsed.count() / ticks;
+
+            out << "{\"traceEvents\":[\n";
+            bool first = true;
+            auto emit = [&](const char* name, const char* ph, uint32_t tid, const event& e, const char* extra) {
+                out << (first ? "" : ",\n")
+                    << "{\"name\":\"" << name << "\",\"ph\":\"" << ph << "\",\"pid\":0,\"tid\":" << tid
+                    << ",\"ts\":" << (int64_t(e.ticks - r.start_ticks) * us_per_tick) << extra << "}";
+                first = false;
+            };
+
+            for (auto& b : r.buffers)
+            {
+                auto n = b->count.load(std::memory_order_acquire);
+                for (auto i = n > buffer::capacity ? n - buffer::capacity : 0; i < n; ++i)
+                {
+                    auto& e = b->events[i % buffer::capacity];
+                    std::string id = ",\"cat\":\"task\",\"id\":" + std::to_string(e.arg);
+                    switch (e.kind)
+                    {
+                    case event_kind::submit:
+                        emit("submit", "i", b->tid, e, ",\"s\":\"t\"");
+                        emit("queued", "s", b->tid, e, id.c_str());
+                        break;
+                    case event_kind::start:
+                        emit("queued", "f", b->tid, e, (id + ",\"bp\":\"e\"").c_str());
+                        emit("task", "B", b->tid, e, "");
+                        break;
+                    case event_kind::end:
+                        emit("task", "E", b->tid, e, "");
+                        break;
+                    case event_kind::steal:
+                        emit("steal", "i", b->tid, e, (",\"s\":\"t\",\"args\":{\"from\":" + std::to_string(e.arg) + "}").c_str());
+                        break;
+                    case event_kind::park:
+                        emit("idle", "B", b->tid, e, "");
+                        break;
+                    case event_kind::unpark:
+                        emit("idle", "E", b->tid, e, "");
+                        break;
+                    }
+                }
+            }
+            out << "\n]}\n";
+        }
+    }
+
+} // namespace poly
+
+#else
+
+#define POLY_TRACE_EVENT(kind, arg) ((void)0)
+
+#endif
@@ -1,3 +1,6 @@
+#pragma once
+
+#include <algorithm>
 #include <memory>
 #include <typeinfo>
 #include <typeindex>
@@ -67,7 +70,7 @@ namespace poly
     template<typename U, typename T>
     void inline_storage<U, T>::move_to(void* storage, size_t storageSize)
     {
-        if (storageSize <= sizeof(inline_storage<U, T>)) {
+        if (sizeof(inline_storage<U, T>) <= storageSize) {
             new (storage) inline_storage<U, T>(std::move(_u));
         }
         else {
@@ -98,12 +101,19 @@ namespace poly
     template<typename U, typename T>
     constexpr bool is_acceptable = std::is_convertible<U*, T*>::value;
 
-    // Small buffer optimized unique pointer.
-    template<typename T, size_t storage_size = 120 /* makes the whole thing 128 bytes */>
+    // Small buffer optimized unique pointer. Only objects of at most
+    // inline_limit bytes are stored inline; larger ones stay on the heap even
+    // when the buffer could hold them, so moving them steals a pointer
+    // instead of copying the whole object.
+    template<typename T, size_t storage_size = 120 /* makes the whole thing 128 bytes */,
+        size_t inline_limit = storage_size>
     class unique_ptr
     {
         static_assert(std::is_pointer<T>::value == false, "must not be a pointer");
-        using this_type = unique_ptr<T, storage_size>;
+        using this_type = unique_ptr<T, storage_size, inline_limit>;
+
+        // The largest object stored inline.
+        static constexpr size_t inline_size = inline_limit < storage_size ? inline_limit : storage_size;
     public:
 
         using posize_ter = T * ;
@@ -113,20 +123,44 @@ namespace poly
             sizeof(void*) + (sizeof(void*)> storage_size ? sizeof(void*) : storage_size)
         >::type;
 
+        // The storage size handed to move_to, which only inlines objects whose
+        // wrapper fits in it. The wrapper of an inline_size object is padded
+        // to its alignment, so the limit is rounded up the same way.
+        static constexpr size_t inline_capacity = inline_limit < storage_size ?
+            std::min(sizeof(storage_type),
+                (sizeof(void*) + inline_limit + alignof(storage_type) - 1) / alignof(storage_type) * alignof(storage_type)) :
+            sizeof(storage_type);
+
         // constructors
         unique_ptr() {
             new (&_storage) empty_storage<T>();
         }
 
-        unique_ptr(const unique_ptr<T>&) = delete;
+        unique_ptr(const unique_ptr&) = delete;
+        unique_ptr& operator=(const unique_ptr&) = delete;
+
+        // Same type moves. m is left empty.
+        unique_ptr(unique_ptr&& m) noexcept {
+            m.get_base().move_to(&_storage, inline_capacity);
+            m.reset();
+        }
+
+        unique_ptr& operator=(unique_ptr&& m) noexcept {
+            if (this != &m) {
+                destruct();
+                m.get_base().move_to(&_storage, inline_capacity);
+                m.reset();
+            }
+            return *this;
+        }
 
         // Generalized move function for arbitrary local storage size.
-        template<typename U, size_t other_size,
+        template<typename U, size_t other_size, size_t other_limit,
             typename Enabled =
             typename std::enable_if<is_acceptable<U, T>>::type
         >
-            explicit unique_ptr(unique_ptr<U, other_size>&& m) {
-            m.get_base().move_to(&_storage, sizeof(storage_type));
+            explicit unique_ptr(unique_ptr<U, other_size, other_limit>&& m) {
+            m.get_base().move_to(&_storage, inline_capacity);
         }
 
         ~unique_ptr() {
@@ -135,13 +169,13 @@ namespace poly
 
         // Move operator= from another unique_ptr. Moves U to local storage
         // if U will fit, otherwise places U on the heap (if its not there already).
-        template<typename U, size_t other_size>
+        template<typename U, size_t other_size, size_t other_limit>
         typename std::enable_if<is_acceptable<U, T>,
             this_type&>::type
-            operator=(unique_ptr<U, other_size>&& m)
+            operator=(unique_ptr<U, other_size, other_limit>&& m)
         {
             destruct();
-            m.get_base().move_to(&_storage, sizeof(storage_type));
+            m.get_base().move_to(&_storage, inline_capacity);
             return *this;
         }
 
@@ -152,7 +186,7 @@ namespace poly
             operator=(U&& u)
         {
             destruct();
-            if constexpr(is_small<U, storage_size>)
+            if constexpr(is_small<U, inline_size>)
                 new (&_storage) inline_storage<U, T>(std::forward<U>(u));
             else
                 new (&_storage) heap_storage<U, T>(new U(std::forward<U>(u)));
@@ -166,13 +200,17 @@ namespace poly
         {
             destruct();
 
-            if constexpr(is_small<U, storage_size>)
+            if constexpr(is_small<U, inline_size>)
             {
                 // Check if u is actaully of type U before placing it in local
                 // storage. This check is required to prevent slicing. If false,
                 // make sure its never inlined.
-                if (typeid(*u).hash_code() == typeid(U).hash_code())
+                // Comparing the type_info objects avoids hashing the type names.
+                if (std::is_final_v<U> || typeid(*u) == typeid(U))
+                {
                     new (&_storage) inline_storage<U, T>(std::move(*u));
+                    delete u;
+                }
                 else
                     new (&_storage) heap_storage<U, T, false>(u);
             }
@@ -187,7 +225,7 @@ namespace poly
         template<typename U, typename... Args >
         typename std::enable_if<
             is_acceptable<U, T> &&
-            is_small<U, storage_size> &&
+            is_small<U, inline_size> &&
             std::is_constructible<U, Args...>::value            // U is constructable from Args...
         >::type                                                 // return void
             emplace(Args&&... args)
@@ -199,7 +237,7 @@ namespace poly
         template<typename U, typename... Args >
         typename std::enable_if<
             is_acceptable<U, T> &&
-            is_small<U, storage_size> == false &&
+            is_small<U, inline_size> == false &&
             std::is_constructible<U, Args...>::value            // U is constructable from Args...
         >::type                                                 // return void
             emplace(Args&&... args)
@@ -241,7 +279,7 @@ namespace poly
         const storage_concept<T>& get_base() const { return *(storage_concept<T>*)&_storage; }
 
 
-        template <typename, size_t>
+        template <typename, size_t, size_t>
         friend class unique_ptr;
     };
 
@@ -1,14 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <tuple>
 #include <typeinfo>
 #include <typeindex>
 #include <type_traits>
 #include <utility>
+#include "reclaimer.h"
+#include "relocate.h"
+#include "spill_trace.h"
 
 namespace poly_v2
 {
 
 
 
+    // Identity of a concrete type. Each type has a single tag, so two objects
+    // hold the same type when their tags have the same address.
+    //
+    // index() returns a small dense number for indexing tables by type,
+    // assigned on first use so that it is valid from any static initializer.
+    struct type_tag {
+        const std::type_info& (*info)() noexcept;
+        size_t (*index)() noexcept;
+    };
+
+    inline size_t next_type_index() noexcept
+    {
+        static std::atomic<size_t> next{ 0 };
+        return ++next;
+    }
+
+    template<typename U>
+    struct type_id {
+        static const std::type_info& info() noexcept { return typeid(U); }
+        static size_t index() noexcept
+        {
+            static const size_t i = next_type_index();
+            return i;
+        }
+        static constexpr type_tag tag{ info, index };
+    };
+
+    // The public bases of U that get_as<B>() converts to without RTTI, e.g.
+    //   template<> struct poly_v2::bases<special_small> { using type = std::tuple<small>; };
+    template<typename U>
+    struct bases {
+        using type = std::tuple<>;
+    };
+
+    template<typename U, typename Bases = typename bases<U>::type>
+    struct base_table;
+
+    // Whether a U can be moved to a new address by copying its bytes and not
+    // running its destructor at the old one. Trivially copyable types are;
+    // polymorphic types are not, but most are in practice (the vtable pointer
+    // does not depend on the address) and can opt in, e.g.
+    //   template<> struct poly_v2::trivially_relocatable<particle> : std::true_type {};
+    // Do not opt in types that hold pointers into themselves.
+    template<typename U>
+    struct trivially_relocatable : std::is_trivially_copyable<U> {};
+
+    // Compile time table of the declared bases of U, searched by type tag.
+    template<typename U, typename... B>
+    struct base_table<U, std::tuple<B...>> {
+        static void* cast(U* u, const type_tag* to) noexcept {
+            if constexpr (sizeof...(B) == 0)
+            {
+                (void)u, (void)to;
+                return nullptr;
+            }
+            else
+            {
+                void* r = nullptr;
+                (void)((to == &type_id<B>::tag ? (r = static_cast<B*>(u), true) : false) || ...);
+                return r;
+            }
+        }
+    };
+
     template<typename T>
     struct concept {
         void(*_dtor)(void*) noexcept;
@@ -16,6 +88,11 @@ namespace poly_v2
         T*(*_get)(void*) noexcept;
         T*(*_release)(void*) noexcept;
         bool(*_is_inlined)() noexcept;
+        size_t _inline_size;    // sizeof the inline model of the stored type, 0 if empty.
+        const type_tag* _type;  // nullptr if empty or if the exact type is only known at run time.
+        void*(*_cast)(void*, const type_tag*) noexcept;
+        // Moves the object into storage of the same size and destroys the source.
+        void(*_relocate)(const concept<T>*&, void*, void*) noexcept;
     };
 
     template<typename T>
@@ -25,11 +102,13 @@ namespace poly_v2
         static T* _get(void* self) noexcept { return nullptr; }
         static T* _release(void* self) noexcept { return nullptr; }
         static bool _is_inlined() noexcept { return true; }
-        static constexpr concept<T> vtable{ _dtor, _move, _get,_release, _is_inlined };
+        static void* _cast(void*, const type_tag*) noexcept { return nullptr; }
+        static void _relocate(const concept<T>*& c, void*, void*) noexcept { c = &empty_model::vtable; }
+        static constexpr concept<T> vtable{ _dtor, _move, _get,_release, _is_inlined, 0, nullptr, _cast, _relocate };
     };
 
     template<typename U, typename T> struct inline_model;
-    template<typename U, typename T> struct ptr_model;
+    template<typename U, typename T, bool can_be_inlined = true> struct ptr_model;
 
     template<typename U, typename T>
     struct inline_model {
@@ -47,9 +126,36 @@ namespace poly_v2
 
         static void _move(const concept<T>*& c, void* self, void* dest, size_t dest_size) noexcept {
             if (sizeof(inline_model) <= dest_size)
-                new (dest) inline_model(c, std::move(static_cast<inline_model*>(self)->_u));
+            {
+                // The source is still destroyed after a _move, so only trivially
+                // copyable payloads may be bulk copied here; _relocate covers the
+                // trivially relocatable ones.
+                if constexpr (std::is_trivially_copyable_v<U> && sizeof(U) >= POLY_STREAM_MIN)
+                {
+                    poly::relocate_bytes(dest, self, sizeof(inline_model));
+                    c = &vtable;
+                }
+                else
+                    new (dest) inline_model(c, std::move(static_cast<inline_model*>(self)->_u));
+            }
             else
+            {
+                poly::note_spill<U>();
                 new (dest) ptr_model<U, T>(c, new U(std::move(static_cast<inline_model*>(self)->_u)));
+            }
+        }
+
+        static void _relocate(const concept<T>*& c, void* self, void* dest) noexcept {
+            if constexpr (trivially_relocatable<U>::value)
+            {
+                poly::relocate_bytes(dest, self, sizeof(inline_model));
+                c = &vtable;
+            }
+            else
+            {
+                new (dest) inline_model(c, std::move(static_cast<inline_model*>(self)->_u));
+                _dtor(self);
+            }
         }
 
         static T* _get(void* self) noexcept {
@@ -62,12 +168,18 @@ namespace poly_v2
 
         static bool _is_inlined() noexcept { return true; }
 
-        static constexpr concept<T> vtable{ _dtor, _move, _get,_release, _is_inlined };
+        static void* _cast(void* self, const type_tag* to) noexcept {
+            return base_table<U>::cast(&static_cast<inline_model*>(self)->_u, to);
+        }
+
+        static constexpr concept<T> vtable{ _dtor, _move, _get,_release, _is_inlined, sizeof(inline_model), &type_id<U>::tag, _cast, _relocate };
 
         U _u;
     };
 
-    template<typename U, typename T>
+    // A heap allocated U. When can_be_inlined is false the object is never
+    // moved into inline storage, e.g. because U* may point to a derived type.
+    template<typename U, typename T, bool can_be_inlined>
     struct ptr_model {
 
         ptr_model(const concept<T>*& c, U* u) : _u(u) {
@@ -78,6 +190,7 @@ namespace poly_v2
         ptr_model(const concept<T>*& c, Args&&... args)
             : _u(new U(std::forward<Args>(args)...))
         {
+            poly::note_spill<U>();
             c = &vtable;
         }
 
@@ -88,12 +201,17 @@ namespace poly_v2
         static void _move(const concept<T>*& c, void* _self, void* dest, size_t dest_size) noexcept {
             auto self = static_cast<ptr_model*>(_self);
 
-            if (sizeof(inline_model<U, T>) <= dest_size)
+            if (can_be_inlined && self->_u && sizeof(inline_model<U, T>) <= dest_size)
                 new (dest) inline_model<U, T>(c, std::move(*self->_u.get()));
             else
                 new (dest) ptr_model(c, self->_u.release());
         }
 
+        static void _relocate(const concept<T>*& c, void* self, void* dest) noexcept {
+            new (dest) ptr_model(c, static_cast<ptr_model*>(self)->_u.release());
+            _dtor(self);
+        }
+
         static T* _get(void* self) noexcept {
             return static_cast<ptr_model*>(self)->_u.get();
         }
@@ -102,13 +220,55 @@ namespace poly_v2
             return static_cast<ptr_model*>(self)->_u.release();
         }
 
-        static bool _is_inlined() noexcept { return true; }
+        static bool _is_inlined() noexcept { return false; }
+
+        static void* _cast(void* self, const type_tag* to) noexcept {
+            return base_table<U>::cast(static_cast<ptr_model*>(self)->_u.get(), to);
+        }
+
+        // A U* that may point to a derived object has no exact tag; is<>()
+        // then compares the dynamic type instead.
+        static constexpr const type_tag* exact_tag() noexcept {
+            return can_be_inlined || !std::is_polymorphic_v<T> ? &type_id<U>::tag : nullptr;
+        }
 
-        static constexpr concept<T> vtable{ _dtor, _move, _get,_release, _is_inlined };
+        static constexpr concept<T> vtable{ _dtor, _move, _get,_release, _is_inlined,
+            can_be_inlined ? sizeof(inline_model<U, T>) : SIZE_MAX, exact_tag(), _cast, _relocate };
 
         std::unique_ptr<U> _u;
     };
 
+    // Placement policies for unique_ptr.
+    //  - may_spill: objects that do not fit inline are placed on the heap.
+    //  - no_spill: placing an object that does not fit is a compile error. Moves
+    //    from type erased sources that might not fit must use try_assign.
+    //  - inline_below<limit>: only objects whose inline model is at most limit
+    //    bytes are stored inline. Larger ones stay on the heap even when the
+    //    buffer could hold them, so moving them steals a pointer instead of
+    //    copying the whole object.
+    //  - deferred_deleter: reset() and the destructor hand heap objects to
+    //    poly::reclaimer, which deletes them on a background thread. Inline
+    //    objects are still destroyed in place, and so is a heap object the
+    //    reclaimer fails to queue. T needs a virtual destructor.
+    struct may_spill {
+        static constexpr bool allow_spill = true;
+        static constexpr size_t inline_limit = SIZE_MAX;
+        static constexpr bool defer_delete = false;
+    };
+
+    struct no_spill : may_spill {
+        static constexpr bool allow_spill = false;
+    };
+
+    template<size_t limit>
+    struct inline_below : may_spill {
+        static constexpr size_t inline_limit = limit;
+    };
+
+    struct deferred_deleter : may_spill {
+        static constexpr bool defer_delete = true;
+    };
+
     template<typename U>
     struct in_place
     {
@@ -122,13 +282,77 @@ namespace poly_v2
     template<typename U, typename T>
     constexpr bool is_acceptable = std::is_convertible_v<U*, T*>;
 
+    // The largest inline model unique_ptr<T, storage_size, policy> stores
+    // inline, as limited by the policy.
+    template<size_t storage_size, typename policy>
+    constexpr size_t inline_capacity_of =
+        sizeof(std::aligned_storage_t<storage_size>) < policy::inline_limit ?
+            sizeof(std::aligned_storage_t<storage_size>) : policy::inline_limit;
+
+    // Compile time check that U is stored inline by unique_ptr<T, storage_size, policy>, e.g.
+    //   static_assert(require_inline<special_small, base, 32>());
+    template<typename U, typename T, size_t storage_size, typename policy = may_spill>
+    constexpr bool require_inline()
+    {
+        static_assert(is_small<U, T, inline_capacity_of<storage_size, policy>>,
+            "U does not fit inline and would spill to the heap");
+        return true;
+    }
+
+#ifdef POLY_SIZE_REPORT
+    // With POLY_SIZE_REPORT defined, every (U, T, capacity) placed into a
+    // unique_ptr emits one size_record into the binary. Each record starts
+    // with a magic, so the report is extracted by scanning the file, e.g.
+    //   ./size_report app
+    // with the tool built from size_report.cpp, which also checks itself when
+    // run without arguments. The records are also placed in the poly_size
+    // section, but GCC before 14 ignores section attributes on template
+    // instantiations and leaves them in .rodata, so extracting that section
+    // (objcopy --only-section=poly_size) only works with other compilers.
+#if defined(_MSC_VER)
+#pragma section("poly_size", read)
+#define POLY_SIZE_SECTION __declspec(allocate("poly_size"))
+#define POLY_FUNCTION_NAME __FUNCSIG__
+#else
+#define POLY_SIZE_SECTION __attribute__((section("poly_size"), used))
+#define POLY_FUNCTION_NAME __PRETTY_FUNCTION__
+#endif
+
+    struct size_record {
+        char magic[8];              // "polysz1"
+        uint64_t model_size;        // sizeof(inline_model<U, T>)
+        uint64_t capacity;          // the largest inline model the unique_ptr stores inline
+        uint64_t is_inline;
+        char name[256];             // the signature of size_report<U, T, capacity>::make()
+    };
+
+    template<typename U, typename T, size_t capacity>
+    struct size_report {
+        static constexpr size_record make()
+        {
+            size_record r{ "polysz1", sizeof(inline_model<U, T>), capacity, is_small<U, T, capacity>, {} };
+            const char* name = POLY_FUNCTION_NAME;
+            for (size_t i = 0; i + 1 < sizeof(r.name) && name[i]; ++i)
+                r.name[i] = name[i];
+            return r;
+        }
+
+        POLY_SIZE_SECTION static const size_record record;
+    };
+
+    template<typename U, typename T, size_t capacity>
+    POLY_SIZE_SECTION const size_record size_report<U, T, capacity>::record = size_report::make();
+#endif
+
     // Small buffer optimized unique pointer.
-    template<typename T, size_t storage_size = 128>
+    template<typename T, size_t storage_size = 128, typename policy = may_spill>
     class unique_ptr
     {
-        using this_type = unique_ptr<T, storage_size>;
+        using this_type = unique_ptr<T, storage_size, policy>;
         using storage_type = typename std::aligned_storage_t<storage_size>;
 
+        static constexpr size_t inline_capacity = inline_capacity_of<storage_size, policy>;
+
         const concept<T>* _concept = &empty_model<T>::vtable;
         storage_type _model;
 
@@ -136,12 +360,35 @@ namespace poly_v2
 
         unique_ptr() = default;
 
+        unique_ptr(const unique_ptr&) = delete;
+        unique_ptr& operator=(const unique_ptr&) = delete;
 
-        template<typename U, size_t other_size,
+        // Same type moves relocate the object without changing where it is
+        // stored and leave p empty.
+        unique_ptr(unique_ptr&& p) noexcept
+        {
+            p._concept->_relocate(_concept, &p._model, &_model);
+            p._concept = &empty_model<T>::vtable;
+        }
+
+        unique_ptr& operator=(unique_ptr&& p) noexcept
+        {
+            if (this != &p)
+            {
+                reset();
+                p._concept->_relocate(_concept, &p._model, &_model);
+                p._concept = &empty_model<T>::vtable;
+            }
+            return *this;
+        }
+
+        template<typename U, size_t other_size, typename other_policy,
             typename Enabled = std::enable_if_t<is_acceptable<U, T>>>
-            unique_ptr(unique_ptr<U, other_size>&& p) noexcept
+            unique_ptr(unique_ptr<U, other_size, other_policy>&& p) noexcept
         {
-            p._concept->_move(_concept, &p._model, &_model, sizeof(storage_type));
+            static_assert(always_fits<other_size, other_policy>,
+                "the source may hold an object that does not fit inline, use try_assign");
+            p._concept->_move(_concept, &p._model, &_model, inline_capacity);
         }
 
         template<typename U, typename Enabled = std::enable_if_t<is_acceptable<U, T>>>
@@ -152,26 +399,47 @@ namespace poly_v2
 
         ~unique_ptr() { reset(); }
 
-        template<typename U, size_t other_size>
+        template<typename U, size_t other_size, typename other_policy>
         typename std::enable_if_t<is_acceptable<U, T>,
             this_type&>
-            operator=(unique_ptr<U, other_size>&& p)
+            operator=(unique_ptr<U, other_size, other_policy>&& p)
         {
+            static_assert(always_fits<other_size, other_policy>,
+                "the source may hold an object that does not fit inline, use try_assign");
             reset();
-            p._concept->_move(_concept, &p._model, &_model, sizeof(storage_type));
+            p._concept->_move(_concept, &p._model, &_model, inline_capacity);
             return *this;
         }
 
+        // Moves p into this if its object can be stored inline. Otherwise
+        // returns false and leaves both pointers unchanged.
+        template<typename U, size_t other_size, typename other_policy>
+        typename std::enable_if_t<is_acceptable<U, T>, bool>
+            try_assign(unique_ptr<U, other_size, other_policy>&& p) noexcept
+        {
+            if (p._concept->_inline_size > inline_capacity)
+                return false;
+
+            reset();
+            p._concept->_move(_concept, &p._model, &_model, inline_capacity);
+            return true;
+        }
+
         template<typename U>
         typename std::enable_if_t<is_acceptable<U, T>,
             this_type&>
             operator=(U&& u)
         {
+            note_size<U>();
+            static_assert(policy::allow_spill || is_small<U, T, inline_capacity>, "U does not fit inline");
             reset();
-            if constexpr (is_small<U, T, storage_size>)
+            if constexpr (is_small<U, T, inline_capacity>)
                 new (&_model) inline_model<std::decay_t<U>, T>(_concept, std::forward<U>(u));
             else
+            {
+                poly::note_spill<std::decay_t<U>>();
                 new (&_model) ptr_model<std::decay_t<U>, T>(_concept, new U(std::forward<U>(u)));
+            }
 
             return *this;
         }
@@ -180,10 +448,11 @@ namespace poly_v2
         template<typename U, typename... Args >
         typename std::enable_if_t<
             is_acceptable<U, T> &&
-            is_small<U, T, storage_size> &&
+            is_small<U, T, inline_capacity> &&
             std::is_constructible_v<std::decay_t<U>, Args...>>
             emplace(Args&&... args)
         {
+            note_size<U>();
             reset();
             new (&_model) inline_model<std::decay_t<U>, T>(_concept, std::forward<Args>(args)...);
         }
@@ -191,10 +460,12 @@ namespace poly_v2
         template<typename U, typename... Args >
         typename std::enable_if_t<
             is_acceptable<U, T> &&
-            is_small<U, T, storage_size> == false &&
+            is_small<U, T, inline_capacity> == false &&
             std::is_constructible_v<std::decay_t<U>, Args...>>
             emplace(Args&&... args)
         {
+            note_size<U>();
+            static_assert(policy::allow_spill, "U does not fit inline");
             reset();
             new (&_model) ptr_model<std::decay_t<U>, T>(_concept, std::forward<Args>(args)...);
         }
@@ -204,9 +475,22 @@ namespace poly_v2
         typename std::enable_if_t<is_acceptable<U, T>>
             reset(U*u)
         {
+            note_size<U>();
+            static_assert(policy::allow_spill || is_small<U, T, inline_capacity>, "U does not fit inline");
+            static_assert(policy::allow_spill || std::is_final_v<U>, "U* may point to a derived type that does not fit inline");
             reset();
-            if constexpr (is_small<U, T, storage_size>)
+            if (!u)
+                return;
+
+            // A u that points to a derived object must never be inlined as a
+            // U, here or by a later move, or it would be sliced.
+            if (!std::is_final_v<U> && typeid(*u) != typeid(U))
+                new (&_model) ptr_model<std::decay_t<U>, T, false>(_concept, u);
+            else if constexpr (is_small<U, T, inline_capacity>)
+            {
                 new (&_model) inline_model<std::decay_t<U>, T>(_concept, std::move(*u));
+                delete u;
+            }
             else
                 new (&_model) ptr_model<std::decay_t<U>, T>(_concept, u);
         }
@@ -219,6 +503,7 @@ namespace poly_v2
         {
             if (no_inline)
             {
+                static_assert(policy::allow_spill, "no_spill pointers can not hold heap objects");
                 reset();
                 new (&_model) ptr_model<std::decay_t<U>, T, false>(_concept, u);
             }
@@ -228,20 +513,103 @@ namespace poly_v2
 
         void reset()
         {
+            if constexpr (policy::defer_delete)
+            {
+                static_assert(std::has_virtual_destructor_v<T>, "deferred_deleter deletes through T*");
+                if (!_concept->_is_inlined())
+                {
+                    // Called from the noexcept moves and the destructor, so
+                    // delete in place if the object can not be queued.
+                    if (T* t = _concept->_release(&_model); t && !poly::reclaimer::try_retire(t))
+                        delete t;
+                }
+            }
             _concept->_dtor(&_model);
             _concept = &empty_model<T>::vtable;
         }
 
 
+        // Hands over the object if it is a U, moving an inline one to the
+        // heap first, and leaves this empty. Otherwise returns nullptr and
+        // keeps the object.
         template<typename U = T>
         typename std::enable_if_t<is_acceptable<U,T>, U*>
             release()
         {
-            auto ptr = dynamic_cast<U*>(get());
-            if (ptr)
-                return static_cast<U*>(_concept->_release(&_model));
-            
-            return nullptr;
+            if (!std::is_same_v<U, T> && !get_as<U>())
+                return nullptr;
+
+            auto u = static_cast<U*>(_concept->_release(&_model));
+            _concept->_dtor(&_model);
+            _concept = &empty_model<T>::vtable;
+            return u;
+        }
+
+        // True if the stored object is exactly a U. Compares type tags instead
+        // of using RTTI. Define POLY_CROSS_DSO_TYPES when objects are passed
+        // across shared library boundaries, where a type may have several tags.
+        template<typename U>
+        bool is() const noexcept
+        {
+            const type_tag* tag = _concept->_type;
+            if (tag == &type_id<std::decay_t<U>>::tag)
+                return true;
+            if (!tag)
+            {
+                // Set through a U* whose dynamic type is not known statically.
+                if constexpr (std::is_polymorphic_v<T>)
+                    return _concept != &empty_model<T>::vtable && typeid(*get()) == typeid(U);
+                return false;
+            }
+#ifdef POLY_CROSS_DSO_TYPES
+            return tag->info() == typeid(U);
+#else
+            return false;
+#endif
+        }
+
+        // The stored object if it is exactly a U, otherwise nullptr.
+        template<typename U>
+        typename std::enable_if_t<is_acceptable<U, T>, U*>
+            get_if() noexcept
+        {
+            using V = std::decay_t<U>;
+            if constexpr (std::is_abstract_v<V>)
+                return nullptr;
+            else if (_concept == &inline_model<V, T>::vtable)
+                return &reinterpret_cast<inline_model<V, T>*>(&_model)->_u;
+            else
+                return is<U>() ? static_cast<U*>(get()) : nullptr;
+        }
+
+        template<typename U>
+        typename std::enable_if_t<is_acceptable<U, T>, const U*>
+            get_if() const noexcept
+        {
+            return const_cast<unique_ptr*>(this)->template get_if<U>();
+        }
+
+        // The stored object as a U if it is a U or derives from U. Bases
+        // declared through bases<> are found in the stored type's base table,
+        // anything else falls back to dynamic_cast.
+        template<typename U>
+        typename std::enable_if_t<is_acceptable<U, T>, U*>
+            get_as() noexcept
+        {
+            if constexpr (std::is_same_v<std::decay_t<U>, T>)
+                return get();
+            if (U* u = get_if<U>())
+                return u;
+            if (void* b = _concept->_cast(&_model, &type_id<std::decay_t<U>>::tag))
+                return static_cast<U*>(b);
+            return dynamic_cast<U*>(get());
+        }
+
+        template<typename U>
+        typename std::enable_if_t<is_acceptable<U, T>, const U*>
+            get_as() const noexcept
+        {
+            return const_cast<unique_ptr*>(this)->template get_as<U>();
         }
 
 
@@ -249,19 +617,76 @@ namespace poly_v2
         const T* operator->() const noexcept { return get(); }
 
         T* get() noexcept { return _concept->_get(&_model); }
-        const T* get() const noexcept { return _concept->_get(&_model); }
+        const T* get() const noexcept { return _concept->_get(const_cast<storage_type*>(&_model)); }
 
         explicit operator bool() const noexcept { return get() != nullptr; }
 
         bool is_inlined() const { return _concept->_is_inlined(); }
 
+        // The tag of the stored type. nullptr if empty, or if the object was
+        // set through a pointer to one of its bases; compare typeid(*get()) then.
+        const type_tag* type() const noexcept { return _concept->_type; }
+
+        // Moves a heap object into the inline buffer if it now fits, e.g.
+        // after being moved in from a pointer with a smaller buffer. Returns
+        // true if the object was moved.
+        bool try_inline() noexcept
+        {
+            if (_concept->_is_inlined() || _concept->_inline_size > inline_capacity)
+                return false;
+
+            storage_type tmp;
+            const concept<T>* c;
+            _concept->_move(c, &_model, &tmp, inline_capacity);
+            _concept->_dtor(&_model);
+            c->_relocate(_concept, &tmp, &_model);
+            return true;
+        }
+
     private:
 
+        // Whether every object held by a unique_ptr<U, other_size, other_policy>
+        // can be moved inline into this one.
+        template<size_t other_size, typename other_policy>
+        static constexpr bool always_fits =
+            policy::allow_spill || (!other_policy::allow_spill &&
+                unique_ptr<T, other_size, other_policy>::inline_capacity <= inline_capacity);
+
+        template<typename U>
+        static void note_size() noexcept
+        {
+#ifdef POLY_SIZE_REPORT
+            (void)&size_report<std::decay_t<U>, T, inline_capacity>::record;
+#endif
+        }
 
-        template <typename, size_t>
+        template <typename, size_t, typename>
         friend class unique_ptr;
+
+        friend struct relocation;
+    };
+
+    // Moves objects between pointers of the same type with one _relocate call.
+    struct relocation
+    {
+        // Moves the object of from into to, which must be empty, and leaves from empty.
+        template<typename T, size_t storage_size, typename policy>
+        static void move(unique_ptr<T, storage_size, policy>& from, unique_ptr<T, storage_size, policy>& to) noexcept
+        {
+            from._concept->_relocate(to._concept, &from._model, &to._model);
+            from._concept = &empty_model<T>::vtable;
+        }
     };
 
+    // Swaps the objects with three relocations and no temporaries to destroy.
+    template<typename T, size_t storage_size, typename policy>
+    void swap(unique_ptr<T, storage_size, policy>& a, unique_ptr<T, storage_size, policy>& b) noexcept
+    {
+        unique_ptr<T, storage_size, policy> tmp;
+        relocation::move(a, tmp);
+        relocation::move(b, a);
+        relocation::move(tmp, b);
+    }
 
 } // namespace poly_v2
 